@@ -3,6 +3,7 @@
 from __future__ import print_function, division
 
 import ctypes as c
+import math
 from collections import namedtuple
 from contextlib import contextmanager
 
@@ -49,6 +50,11 @@ lib.osrmc_params_add_coordinate.restype = None
 lib.osrmc_params_add_coordinate.argtypes = [c.c_void_p, c.c_float, c.c_float, c.c_void_p]
 lib.osrmc_params_add_coordinate.errcheck = osrmc_error_errcheck
 
+lib.osrmc_params_add_coordinates.restype = None
+lib.osrmc_params_add_coordinates.argtypes = [c.c_void_p, c.POINTER(c.c_float), c.POINTER(c.c_float), c.c_size_t,
+                                             c.c_void_p, c.c_void_p, c.c_void_p, c.c_void_p]
+lib.osrmc_params_add_coordinates.errcheck = osrmc_error_errcheck
+
 # Route Params
 lib.osrmc_route_params_construct.restype = c.c_void_p
 lib.osrmc_route_params_construct.argtypes = [c.c_void_p]
@@ -73,6 +79,9 @@ lib.osrmc_route_response_duration.restype = c.c_float
 lib.osrmc_route_response_duration.argtypes = [c.c_void_p, c.c_void_p]
 lib.osrmc_route_response_duration.errcheck = osrmc_error_errcheck
 
+lib.osrmc_route_batch.restype = None
+lib.osrmc_route_batch.argtypes = [c.c_void_p, c.POINTER(c.c_void_p), c.c_size_t, c.c_void_p, c.POINTER(c.c_void_p)]
+
 # Table Params
 lib.osrmc_table_params_construct.restype = c.c_void_p
 lib.osrmc_table_params_construct.argtypes = [c.c_void_p]
@@ -94,6 +103,10 @@ lib.osrmc_table_response_duration.restype = c.c_float
 lib.osrmc_table_response_duration.argtypes = [c.c_void_p, c.c_ulong, c.c_ulong, c.c_void_p]
 lib.osrmc_table_response_duration.errcheck = osrmc_error_errcheck
 
+lib.osrmc_table_response_durations_copy.restype = None
+lib.osrmc_table_response_durations_copy.argtypes = [c.c_void_p, c.POINTER(c.c_float), c.c_size_t, c.c_void_p, c.c_void_p]
+lib.osrmc_table_response_durations_copy.errcheck = osrmc_error_errcheck
+
 
 # Python Library Interface
 
@@ -134,6 +147,10 @@ def scoped_table(osrm, params):
     lib.osrmc_table_response_destruct(route)
 
 
+class osrmc_route_summary(c.Structure):
+    _fields_ = [('distance', c.c_float), ('duration', c.c_float)]
+
+
 Coordinate = namedtuple('Coordinate', 'longitude latitude')
 Route = namedtuple('Route', 'distance duration')
 Table = list
@@ -171,16 +188,48 @@ class OSRM:
                 else:
                     return None
 
+    def routes(_, queries):
+        n = len(queries)
+        params = (c.c_void_p * n)()
+        results = (osrmc_route_summary * n)()
+
+        try:
+            for i, coordinates in enumerate(queries):
+                params[i] = lib.osrmc_route_params_construct(c.byref(osrmc_error()))
+                assert params[i]
+
+                for coordinate in coordinates:
+                    lib.osrmc_params_add_coordinate(params[i], coordinate.longitude, coordinate.latitude, c.byref(osrmc_error()))
+
+            # Failed queries are INFINITY, no need for error objects
+            lib.osrmc_route_batch(_.osrm, params, n, results, None)
+        finally:
+            for i in range(n):
+                if params[i]:
+                    lib.osrmc_route_params_destruct(params[i])
+
+        return [None if math.isinf(result.distance) else Route(distance=result.distance, duration=result.duration)
+                for result in results]
+
     def table(_, coordinates):
         with scoped_table_params() as params:
             assert params
 
-            for coordinate in coordinates:
-                lib.osrmc_params_add_coordinate(params, coordinate.longitude, coordinate.latitude, c.byref(osrmc_error()))
+            n = len(coordinates)
+            longitudes = (c.c_float * n)(*(coordinate.longitude for coordinate in coordinates))
+            latitudes = (c.c_float * n)(*(coordinate.latitude for coordinate in coordinates))
+            lib.osrmc_params_add_coordinates(params, longitudes, latitudes, n, None, None, None, c.byref(osrmc_error()))
 
             with scoped_table(_.osrm, params) as table:
                 if table:
                     n = len(coordinates)  # Only symmetric version supported
-                    return Table([lib.osrmc_table_response_duration(table, s, t, c.byref(osrmc_error())) for t in range(n)] for s in range(n))
+                    durations = (c.c_float * (n * n))()
+                    lib.osrmc_table_response_durations_copy(table, durations, n * n, None, c.byref(osrmc_error()))
+
+                    # Unreachable cells raise like the per-cell accessor does
+                    if any(math.isinf(duration) for duration in durations):
+                        raise RuntimeError('Impossible route between points')
+
+                    return Table(durations[s * n:(s + 1) * n] for s in range(n))
                 else:
                     return None
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+
+# Writes a synthetic OSM extract: a rows x cols grid of residential streets.
+# Usage: gen_grid.py rows cols spacing longitude latitude > grid.osm
+
+import sys
+
+
+def main():
+    if len(sys.argv) != 6:
+        sys.exit('Usage: {} rows cols spacing longitude latitude'.format(sys.argv[0]))
+
+    rows, cols = int(sys.argv[1]), int(sys.argv[2])
+    spacing, longitude, latitude = float(sys.argv[3]), float(sys.argv[4]), float(sys.argv[5])
+
+    node = lambda row, col: row * cols + col + 1
+    out = sys.stdout
+
+    out.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+    out.write('<osm version="0.6" generator="libosrmc gen_grid.py">\n')
+
+    for row in range(rows):
+        for col in range(cols):
+            out.write('  <node id="{}" version="1" lat="{:.7f}" lon="{:.7f}"/>\n'.format(
+                node(row, col), latitude + row * spacing, longitude + col * spacing))
+
+    way = 1
+
+    def street(nodes, name):
+        out.write('  <way id="{}" version="1">\n'.format(way))
+        for ref in nodes:
+            out.write('    <nd ref="{}"/>\n'.format(ref))
+        out.write('    <tag k="highway" v="residential"/>\n')
+        out.write('    <tag k="name" v="{}"/>\n'.format(name))
+        out.write('  </way>\n')
+
+    for row in range(rows):
+        street([node(row, col) for col in range(cols)], 'Row {}'.format(row))
+        way += 1
+
+    for col in range(cols):
+        street([node(row, col) for row in range(rows)], 'Column {}'.format(col))
+        way += 1
+
+    out.write('</osm>\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,660 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../osrmc.h"
+
+
+/* Latency, throughput and allocation benchmark for the osrmc services.
+ *
+ * Runs Route, Table (several sizes), Nearest and Match against a dataset built from the synthetic grid written by
+ * gen_grid.py and reports per service: queries per second, p50/p99 latency of the osrmc call, how much of the median
+ * call is spent in the engine and in extracting the response from libosrm's JSON (from osrmc's stats), the time spent
+ * reading the response back through the accessors, and heap allocations per call. See `make bench` for the setup.
+ */
+
+
+/* Allocation counting: interpose the allocator and forward to glibc, counting per thread */
+
+#if defined(__GLIBC__)
+#define BENCH_COUNTS_ALLOCATIONS 1
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static __thread unsigned long bench_allocations;
+
+void* malloc(size_t size) {
+  ++bench_allocations;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+  ++bench_allocations;
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  ++bench_allocations;
+  return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_COUNTS_ALLOCATIONS 0
+
+static unsigned long bench_allocations;
+#endif
+
+
+/* Synthetic grid the dataset was built from, has to match gen_grid.py's arguments */
+
+struct bench_grid {
+  unsigned rows;
+  unsigned cols;
+  double spacing;
+  double longitude;
+  double latitude;
+};
+
+struct bench_options {
+  const char* base_path;
+  unsigned concurrency;
+  unsigned iterations;
+  unsigned warmup;
+  unsigned table_sizes[16];
+  unsigned num_table_sizes;
+  unsigned trace_length;
+  osrmc_algorithm_t algorithm;
+  struct bench_grid grid;
+};
+
+struct bench_sample {
+  double call_us;
+  double access_us;
+  unsigned long allocations;
+};
+
+struct bench_worker;
+
+typedef int (*bench_query_t)(struct bench_worker* worker, struct bench_sample* sample);
+
+struct bench_workload {
+  const char* name;
+  bench_query_t query;
+  osrmc_service_t service;
+  unsigned size;
+};
+
+struct bench_worker {
+  pthread_t thread;
+  osrmc_osrm_t osrm;
+  const struct bench_options* options;
+  const struct bench_workload* workload;
+  unsigned seed;
+  unsigned iterations;
+  unsigned errors;
+  struct bench_sample* samples;
+  float* matrix;
+};
+
+
+static double bench_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double bench_uniform(unsigned* seed) { return rand_r(seed) / (RAND_MAX + 1.0); }
+
+/* Random location inside the grid, slightly off the streets so that snapping does real work */
+static void bench_location(struct bench_worker* worker, float* longitude, float* latitude) {
+  const struct bench_grid* grid = &worker->options->grid;
+
+  *longitude = (float)(grid->longitude + bench_uniform(&worker->seed) * (grid->cols - 1) * grid->spacing);
+  *latitude = (float)(grid->latitude + bench_uniform(&worker->seed) * (grid->rows - 1) * grid->spacing);
+}
+
+static void bench_error(struct bench_worker* worker, osrmc_error_t error) {
+  /* Report the first error per worker, count the rest */
+  if (worker->errors++ == 0)
+    fprintf(stderr, "%s: %s: %s\n", worker->workload->name, osrmc_error_code(error), osrmc_error_message(error));
+
+  osrmc_error_destruct(error);
+}
+
+
+/* Service queries: set up parameters untimed, then time the call and the accessors separately */
+
+static int bench_route(struct bench_worker* worker, struct bench_sample* sample) {
+  osrmc_error_t error = NULL;
+  osrmc_route_params_t params;
+  osrmc_route_response_t response;
+  unsigned long allocations;
+  volatile float sink;
+  float longitude, latitude;
+  double start, called;
+  unsigned i;
+
+  params = osrmc_route_params_acquire(&error);
+  if (error)
+    goto failure;
+
+  for (i = 0; i < 2; ++i) {
+    bench_location(worker, &longitude, &latitude);
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitude, latitude, &error);
+  }
+
+  if (error)
+    goto params_cleanup;
+
+  allocations = bench_allocations;
+  start = bench_now_us();
+
+  response = osrmc_route(worker->osrm, params, &error);
+
+  called = bench_now_us();
+  sample->allocations = bench_allocations - allocations;
+
+  if (error)
+    goto params_cleanup;
+
+  sink = osrmc_route_response_distance(response, &error);
+  sink = osrmc_route_response_duration(response, &error);
+  (void)sink;
+
+  sample->access_us = bench_now_us() - called;
+  sample->call_us = called - start;
+
+  osrmc_route_response_destruct(response);
+params_cleanup:
+  osrmc_route_params_release(params);
+failure:
+  if (error) {
+    bench_error(worker, error);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int bench_table(struct bench_worker* worker, struct bench_sample* sample) {
+  const unsigned size = worker->workload->size;
+
+  osrmc_error_t error = NULL;
+  osrmc_table_params_t params;
+  osrmc_table_response_t response;
+  unsigned long allocations;
+  float longitude, latitude;
+  double start, called;
+  unsigned i;
+
+  params = osrmc_table_params_acquire(&error);
+  if (error)
+    goto failure;
+
+  for (i = 0; i < size && !error; ++i) {
+    bench_location(worker, &longitude, &latitude);
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitude, latitude, &error);
+  }
+
+  if (error)
+    goto params_cleanup;
+
+  allocations = bench_allocations;
+  start = bench_now_us();
+
+  response = osrmc_table(worker->osrm, params, &error);
+
+  called = bench_now_us();
+  sample->allocations = bench_allocations - allocations;
+
+  if (error)
+    goto params_cleanup;
+
+  osrmc_table_response_durations_copy(response, worker->matrix, (size_t)size * size, NULL, &error);
+
+  sample->access_us = bench_now_us() - called;
+  sample->call_us = called - start;
+
+  osrmc_table_response_destruct(response);
+params_cleanup:
+  osrmc_table_params_release(params);
+failure:
+  if (error) {
+    bench_error(worker, error);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int bench_nearest(struct bench_worker* worker, struct bench_sample* sample) {
+  osrmc_error_t error = NULL;
+  osrmc_nearest_params_t params;
+  osrmc_nearest_response_t response;
+  unsigned long allocations;
+  volatile float sink;
+  volatile const char* name;
+  float longitude, latitude;
+  double start, called;
+  size_t i, count;
+
+  params = osrmc_nearest_params_acquire(&error);
+  if (error)
+    goto failure;
+
+  bench_location(worker, &longitude, &latitude);
+  osrmc_params_add_coordinate((osrmc_params_t)params, longitude, latitude, &error);
+  osrmc_nearest_set_number_of_results(params, worker->workload->size, &error);
+
+  if (error)
+    goto params_cleanup;
+
+  allocations = bench_allocations;
+  start = bench_now_us();
+
+  response = osrmc_nearest(worker->osrm, params, &error);
+
+  called = bench_now_us();
+  sample->allocations = bench_allocations - allocations;
+
+  if (error)
+    goto params_cleanup;
+
+  count = osrmc_nearest_response_count(response);
+
+  for (i = 0; i < count && !error; ++i) {
+    sink = osrmc_nearest_response_longitude(response, i, &error);
+    sink = osrmc_nearest_response_latitude(response, i, &error);
+    sink = osrmc_nearest_response_distance(response, i, &error);
+    name = osrmc_nearest_response_name(response, i, &error);
+  }
+
+  (void)sink;
+  (void)name;
+
+  sample->access_us = bench_now_us() - called;
+  sample->call_us = called - start;
+
+  osrmc_nearest_response_destruct(response);
+params_cleanup:
+  osrmc_nearest_params_release(params);
+failure:
+  if (error) {
+    bench_error(worker, error);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int bench_match(struct bench_worker* worker, struct bench_sample* sample) {
+  const struct bench_grid* grid = &worker->options->grid;
+  const unsigned length = worker->workload->size;
+  /* Fix every half block, so that traces along a row stay within the grid */
+  const double step = grid->spacing / 2;
+
+  osrmc_error_t error = NULL;
+  osrmc_match_params_t params;
+  osrmc_match_response_t response;
+  unsigned long allocations;
+  volatile float sink;
+  float longitude, latitude;
+  double start, called, origin, noise;
+  unsigned i, row, span;
+  size_t count;
+
+  params = osrmc_match_params_acquire(&error);
+  if (error)
+    goto failure;
+
+  /* Drive east along a random row, with fixes jittered off the street by a fraction of a block */
+  span = (unsigned)((grid->cols - 1) * grid->spacing / step);
+  row = (unsigned)(bench_uniform(&worker->seed) * grid->rows);
+  origin = grid->longitude + (span > length ? (unsigned)(bench_uniform(&worker->seed) * (span - length)) : 0) * step;
+
+  for (i = 0; i < length && !error; ++i) {
+    noise = (bench_uniform(&worker->seed) - 0.5) * grid->spacing * 0.1;
+    longitude = (float)(origin + i * step);
+    latitude = (float)(grid->latitude + row * grid->spacing + noise);
+
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitude, latitude, &error);
+    if (!error)
+      osrmc_match_params_add_timestamp(params, 1000000 + i * 5, &error);
+  }
+
+  if (error)
+    goto params_cleanup;
+
+  allocations = bench_allocations;
+  start = bench_now_us();
+
+  response = osrmc_match(worker->osrm, params, &error);
+
+  called = bench_now_us();
+  sample->allocations = bench_allocations - allocations;
+
+  if (error)
+    goto params_cleanup;
+
+  count = osrmc_match_response_num_matchings(response);
+
+  for (i = 0; i < count && !error; ++i)
+    sink = osrmc_match_response_confidence(response, i, &error);
+
+  count = osrmc_match_response_num_tracepoints(response);
+
+  for (i = 0; i < count && !error; ++i)
+    osrmc_match_response_tracepoint(response, i, &longitude, &latitude, &error);
+
+  sink = longitude + latitude;
+  (void)sink;
+
+  sample->access_us = bench_now_us() - called;
+  sample->call_us = called - start;
+
+  osrmc_match_response_destruct(response);
+params_cleanup:
+  osrmc_match_params_release(params);
+failure:
+  if (error) {
+    bench_error(worker, error);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/* Workers and reporting */
+
+static void* bench_worker_run(void* data) {
+  struct bench_worker* worker = data;
+  struct bench_sample discard;
+  unsigned i;
+
+  for (i = 0; i < worker->options->warmup; ++i)
+    worker->workload->query(worker, &discard);
+
+  worker->errors = 0;
+
+  for (i = 0; i < worker->iterations;)
+    if (worker->workload->query(worker, &worker->samples[i]))
+      ++i;
+    else if (worker->errors > worker->iterations)
+      break;
+
+  worker->iterations = i;
+  return NULL;
+}
+
+static int bench_compare(const void* lhs, const void* rhs) {
+  const double a = *(const double*)lhs;
+  const double b = *(const double*)rhs;
+  return (a > b) - (a < b);
+}
+
+static double bench_percentile(const double* sorted, size_t n, double p) {
+  size_t rank;
+
+  if (n == 0)
+    return NAN;
+
+  rank = (size_t)ceil(p * n);
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int bench_run(osrmc_osrm_t osrm, const struct bench_options* options, const struct bench_workload* workload) {
+  const unsigned concurrency = options->concurrency;
+  const unsigned per_worker = (options->iterations + concurrency - 1) / concurrency;
+
+  struct bench_worker* workers;
+  osrmc_error_t error = NULL;
+  osrmc_stats_t stats;
+  double *latencies, start, elapsed, access_us = 0;
+  unsigned long allocations = 0;
+  unsigned errors = 0;
+  size_t n = 0;
+  unsigned i, j;
+  int rc;
+
+  workers = calloc(concurrency, sizeof(*workers));
+  latencies = calloc((size_t)per_worker * concurrency, sizeof(*latencies));
+
+  if (!workers || !latencies) {
+    fprintf(stderr, "%s: out of memory\n", workload->name);
+    free(workers);
+    free(latencies);
+    return 0;
+  }
+
+  for (i = 0; i < concurrency; ++i) {
+    workers[i].osrm = osrm;
+    workers[i].options = options;
+    workers[i].workload = workload;
+    workers[i].seed = 0x5eed + i;
+    workers[i].iterations = per_worker;
+    workers[i].samples = calloc(per_worker, sizeof(*workers[i].samples));
+    workers[i].matrix = workload->query == bench_table ? calloc((size_t)workload->size * workload->size, sizeof(float))
+                                                       : NULL;
+  }
+
+  osrmc_osrm_stats_reset(osrm);
+  start = bench_now_us();
+
+  for (i = 0; i < concurrency; ++i)
+    if ((rc = pthread_create(&workers[i].thread, NULL, bench_worker_run, &workers[i])) != 0) {
+      fprintf(stderr, "%s: pthread_create: %s\n", workload->name, strerror(rc));
+      exit(EXIT_FAILURE);
+    }
+
+  for (i = 0; i < concurrency; ++i)
+    pthread_join(workers[i].thread, NULL);
+
+  elapsed = bench_now_us() - start;
+
+  stats = osrmc_stats_snapshot(osrm, &error);
+  if (error) {
+    fprintf(stderr, "%s: %s\n", workload->name, osrmc_error_message(error));
+    osrmc_error_destruct(error);
+  }
+
+  for (i = 0; i < concurrency; ++i) {
+    for (j = 0; j < workers[i].iterations; ++j) {
+      latencies[n++] = workers[i].samples[j].call_us;
+      access_us += workers[i].samples[j].access_us;
+      allocations += workers[i].samples[j].allocations;
+    }
+
+    errors += workers[i].errors;
+    free(workers[i].samples);
+    free(workers[i].matrix);
+  }
+
+  qsort(latencies, n, sizeof(*latencies), bench_compare);
+
+  printf("%-16s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.2f", workload->name, n, n / (elapsed / 1e6),
+         bench_percentile(latencies, n, 0.50), bench_percentile(latencies, n, 0.99),
+         stats ? osrmc_stats_engine_seconds(stats, workload->service, 0.50) * 1e6 : NAN,
+         stats ? osrmc_stats_extraction_seconds(stats, workload->service, 0.50) * 1e6 : NAN,
+         n ? access_us / n : NAN);
+
+  if (BENCH_COUNTS_ALLOCATIONS)
+    printf(" %12.1f", n ? (double)allocations / n : NAN);
+  else
+    printf(" %12s", "n/a");
+
+  printf(" %8u\n", errors);
+  fflush(stdout);
+
+  osrmc_stats_destruct(stats);
+  free(workers);
+  free(latencies);
+  return errors == 0;
+}
+
+
+/* Command line */
+
+static void bench_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] base.osrm\n"
+          "  -c concurrency      worker threads issuing queries (default 1)\n"
+          "  -n iterations       measured queries per service, across all workers (default 1000)\n"
+          "  -w warmup           unmeasured queries per worker and service (default 10)\n"
+          "  -t size[,size..]    table sizes, square matrices (default 10,50,100)\n"
+          "  -l length           match trace length in fixes (default 20)\n"
+          "  -a ch|mld           routing algorithm the dataset was prepared for (default ch)\n"
+          "  -g rows,cols,spacing,longitude,latitude\n"
+          "                      grid the dataset was generated from (default 100,100,0.001,13.38,52.51)\n",
+          program);
+}
+
+static int bench_parse_sizes(const char* arg, struct bench_options* options) {
+  char* end;
+  unsigned long size;
+
+  options->num_table_sizes = 0;
+
+  do {
+    errno = 0;
+    size = strtoul(arg, &end, 10);
+
+    if (errno || end == arg || size == 0 || options->num_table_sizes == 16)
+      return 0;
+
+    options->table_sizes[options->num_table_sizes++] = (unsigned)size;
+    arg = end + 1;
+  } while (*end == ',');
+
+  return *end == '\0';
+}
+
+static int bench_parse_grid(const char* arg, struct bench_grid* grid) {
+  return sscanf(arg, "%u,%u,%lf,%lf,%lf", &grid->rows, &grid->cols, &grid->spacing, &grid->longitude,
+                &grid->latitude) == 5 &&
+         grid->rows > 1 && grid->cols > 1 && grid->spacing > 0;
+}
+
+int main(int argc, char** argv) {
+  struct bench_options options = {NULL, 1, 1000, 10, {10, 50, 100}, 3, 20, OSRMC_ALGORITHM_CH,
+                                  {100, 100, 0.001, 13.38, 52.51}};
+  struct bench_workload workloads[16 + 3];
+  char names[16][32];
+  osrmc_error_t error = NULL;
+  osrmc_config_t config;
+  osrmc_osrm_t osrm;
+  unsigned i, n = 0;
+  int opt, ok = 1;
+
+  while ((opt = getopt(argc, argv, "c:n:w:t:l:a:g:h")) != -1) {
+    switch (opt) {
+    case 'c':
+      options.concurrency = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      options.iterations = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      options.warmup = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      if (!bench_parse_sizes(optarg, &options)) {
+        fprintf(stderr, "Invalid table sizes: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'l':
+      options.trace_length = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'a':
+      if (strcmp(optarg, "ch") == 0)
+        options.algorithm = OSRMC_ALGORITHM_CH;
+      else if (strcmp(optarg, "mld") == 0)
+        options.algorithm = OSRMC_ALGORITHM_MLD;
+      else {
+        fprintf(stderr, "Invalid algorithm: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'g':
+      if (!bench_parse_grid(optarg, &options.grid)) {
+        fprintf(stderr, "Invalid grid: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      bench_usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc || options.concurrency == 0 || options.iterations == 0 || options.trace_length < 2) {
+    bench_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  options.base_path = argv[optind];
+
+  workloads[n].name = "route";
+  workloads[n].query = bench_route;
+  workloads[n].service = OSRMC_SERVICE_ROUTE;
+  workloads[n++].size = 2;
+
+  for (i = 0; i < options.num_table_sizes; ++i) {
+    snprintf(names[i], sizeof(names[i]), "table %ux%u", options.table_sizes[i], options.table_sizes[i]);
+    workloads[n].name = names[i];
+    workloads[n].query = bench_table;
+    workloads[n].service = OSRMC_SERVICE_TABLE;
+    workloads[n++].size = options.table_sizes[i];
+  }
+
+  workloads[n].name = "nearest";
+  workloads[n].query = bench_nearest;
+  workloads[n].service = OSRMC_SERVICE_NEAREST;
+  workloads[n++].size = 1;
+
+  workloads[n].name = "match";
+  workloads[n].query = bench_match;
+  workloads[n].service = OSRMC_SERVICE_MATCH;
+  workloads[n++].size = options.trace_length;
+
+  config = osrmc_config_construct(options.base_path, &error);
+  if (error)
+    goto config_cleanup;
+
+  osrmc_config_set_algorithm(config, options.algorithm, &error);
+  osrmc_config_set_stats(config, true, &error);
+  if (error)
+    goto config_cleanup;
+
+  osrm = osrmc_osrm_construct(config, &error);
+  if (error)
+    goto config_cleanup;
+
+  printf("%s, %u worker(s), %u queries per service\n\n", options.base_path, options.concurrency, options.iterations);
+  printf("%-16s %8s %10s %10s %10s %10s %10s %10s %12s %8s\n", "service", "queries", "qps", "p50 us", "p99 us",
+         "engine us", "extract us", "access us", "allocs/call", "errors");
+
+  for (i = 0; i < n; ++i)
+    ok &= bench_run(osrm, &options, &workloads[i]);
+
+  osrmc_osrm_destruct(osrm);
+config_cleanup:
+  osrmc_config_destruct(config);
+
+  if (error) {
+    fprintf(stderr, "Error: code=%s, message=%s\n", osrmc_error_code(error), osrmc_error_message(error));
+    osrmc_error_destruct(error);
+    return EXIT_FAILURE;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
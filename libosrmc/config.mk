@@ -6,3 +6,18 @@ VERSION_MINOR = 4
 CXXFLAGS = -O2 -Wall -Wextra -pedantic -std=c++11 -fvisibility=hidden -fPIC -fno-rtti $(shell pkg-config --cflags libosrm)
 LDFLAGS  = -shared -Wl,-soname,libosrmc.so.$(VERSION_MAJOR)
 LDLIBS   = -lstdc++ $(shell pkg-config --libs libosrm)
+
+# `make bench`: dataset is built from a generated rows,cols,spacing,longitude,latitude street grid with OSRM_PROFILE
+OSRM_PROFILE      ?= /usr/local/share/osrm/profiles/car.lua
+BENCH_ALGORITHM   ?= ch
+BENCH_GRID        ?= 100,100,0.001,13.38,52.51
+BENCH_CONCURRENCY ?= 1
+BENCH_ITERATIONS  ?= 1000
+BENCH_TABLE_SIZES ?= 10,50,100
+
+# `make test`: same profile and algorithm, a small grid and the same grid with twice the spacing to reload into
+TEST_GRID         ?= 20,20,0.001,13.38,52.51
+TEST_RELOAD_GRID  ?= 20,20,0.002,13.38,52.51
+
+BENCH_CFLAGS = -O2 -g -Wall -Wextra -pedantic -std=c99 -pthread
+BENCH_LDLIBS = -lpthread -lm
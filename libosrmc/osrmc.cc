@@ -1,8 +1,27 @@
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 #include <osrm/coordinate.hpp>
 #include <osrm/engine_config.hpp>
@@ -12,367 +31,4596 @@
 #include <osrm/table_parameters.hpp>
 #include <osrm/nearest_parameters.hpp>
 #include <osrm/match_parameters.hpp>
+#include <osrm/trip_parameters.hpp>
 #include <osrm/status.hpp>
 #include <osrm/storage_config.hpp>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "osrmc.h"
 
-/* ABI stability */
+/* ABI stability */
+
+unsigned osrmc_get_version(void) { return OSRMC_VERSION; }
+
+int osrmc_is_abi_compatible(void) { return osrmc_get_version() >> 16u == OSRMC_VERSION_MAJOR; }
+
+/* API */
+
+/* Status codes: libosrm's error codes plus the ones osrmc adds, with static messages indexed by osrmc_status_t */
+
+static const char* const osrmc_status_codes[] = {
+    "Ok",           "InvalidUrl", "InvalidService", "InvalidVersion", "InvalidOptions", "InvalidQuery",
+    "InvalidValue", "NoSegment",  "TooBig",         "NoRoute",        "NoTable",        "NoMatch",
+    "NoTrips",      "NotImplemented", "InvalidBuffer", "Exception",   "Unknown",        "Timeout",
+    "Overloaded"};
+
+static const char* const osrmc_status_messages[] = {"Success",
+                                                    "URL string malformed",
+                                                    "Service name invalid",
+                                                    "Version not found",
+                                                    "Options are invalid",
+                                                    "The query string is syntactically malformed",
+                                                    "The successfully parsed query parameters are invalid",
+                                                    "One of the supplied input coordinates could not snap to network",
+                                                    "The request size violates one of the service specific limits",
+                                                    "No route found",
+                                                    "No table found",
+                                                    "No matchings found",
+                                                    "No trips found",
+                                                    "This request is not supported",
+                                                    "Buffer too small",
+                                                    "Exception",
+                                                    "Unknown error",
+                                                    "Deadline expired before the query could start",
+                                                    "Too many queries waiting to run"};
+
+static const std::size_t osrmc_num_statuses = sizeof(osrmc_status_codes) / sizeof(osrmc_status_codes[0]);
+
+static_assert(sizeof(osrmc_status_messages) / sizeof(osrmc_status_messages[0]) == osrmc_num_statuses,
+              "status codes and messages out of sync");
+
+static osrmc_status_t osrmc_status_from_code(const std::string& code) {
+  for (std::size_t i = 1; i < osrmc_num_statuses; ++i)
+    if (code == osrmc_status_codes[i])
+      return static_cast<osrmc_status_t>(i);
+
+  return OSRMC_STATUS_UNKNOWN;
+}
+
+/* Status of the last failure on this thread, see osrmc_last_status */
+static thread_local osrmc_status_t osrmc_status_last = OSRMC_STATUS_OK;
+
+struct osrmc_error final {
+  osrmc_status_t status;
+  std::string code;
+  std::string message;
+};
+
+/* All failures go through here: records the status and only allocates an error object if the caller asked for one */
+static osrmc_status_t osrmc_error_set(osrmc_error_t* error, osrmc_status_t status, const char* message) {
+  osrmc_status_last = status;
+
+  if (error)
+    *error = new osrmc_error{status, osrmc_status_codes[status], message};
+
+  return status;
+}
+
+static osrmc_status_t osrmc_error_from_exception(const std::exception& e, osrmc_error_t* error) {
+  return osrmc_error_set(error, OSRMC_STATUS_EXCEPTION, e.what());
+}
+
+static osrmc_status_t osrmc_error_from_json(osrm::json::Object& json, osrmc_error_t* error) try {
+  auto code = json.values["code"].get<osrm::json::String>().value;
+  const auto status = osrmc_status_from_code(code);
+
+  osrmc_status_last = status;
+
+  if (error) {
+    auto message = json.values["message"].get<osrm::json::String>().value;
+    if (code.empty()) {
+      code = "Unknown";
+    }
+
+    *error = new osrmc_error{status, code, message};
+  }
+
+  return status;
+} catch (const std::exception& e) {
+  return osrmc_error_from_exception(e, error);
+}
+
+/* First failure of a parallel operation, reported on the calling thread once all workers are done.
+ * Workers only ask for error objects while none has been recorded, later failures allocate nothing. */
+
+class osrmc_first_failure final {
+public:
+  explicit osrmc_first_failure(const osrmc_error_t* caller_error) : details{caller_error != nullptr} {}
+
+  ~osrmc_first_failure() { delete error; }
+
+  /* Where a worker should put the details of its failure, if anywhere */
+  osrmc_error_t* details_for(osrmc_error_t& worker_error) {
+    return details && !failed.load(std::memory_order_relaxed) ? &worker_error : nullptr;
+  }
+
+  void record(osrmc_status_t worker_status, osrmc_error_t worker_error) {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    if (status == OSRMC_STATUS_OK) {
+      status = worker_status;
+      error = worker_error;
+      failed.store(true, std::memory_order_relaxed);
+    } else {
+      delete worker_error;
+    }
+  }
+
+  /* Hands the failure to the caller, returns false if there was none */
+  bool report(osrmc_error_t* caller_error) {
+    if (status == OSRMC_STATUS_OK)
+      return false;
+
+    if (caller_error && error) {
+      *caller_error = error;
+      error = nullptr;
+      osrmc_status_last = status;
+    } else {
+      osrmc_error_set(caller_error, status, osrmc_status_messages[status]);
+    }
+
+    return true;
+  }
+
+private:
+  const bool details;
+  std::atomic<bool> failed{false};
+  std::mutex mutex;
+  osrmc_status_t status = OSRMC_STATUS_OK;
+  osrmc_error_t error = nullptr;
+};
+
+const char* osrmc_error_code(osrmc_error_t error) { return error->code.c_str(); }
+
+const char* osrmc_error_message(osrmc_error_t error) { return error->message.c_str(); }
+
+void osrmc_error_destruct(osrmc_error_t error) { delete error; }
+
+osrmc_status_t osrmc_error_status(osrmc_error_t error) { return error->status; }
+
+osrmc_status_t osrmc_last_status(void) { return osrmc_status_last; }
+
+void osrmc_clear_status(void) { osrmc_status_last = OSRMC_STATUS_OK; }
+
+const char* osrmc_status_code(osrmc_status_t status) {
+  return static_cast<std::size_t>(status) < osrmc_num_statuses ? osrmc_status_codes[status] : "Unknown";
+}
+
+const char* osrmc_status_message(osrmc_status_t status) {
+  return static_cast<std::size_t>(status) < osrmc_num_statuses ? osrmc_status_messages[status] : "Unknown error";
+}
+
+/* Worker pool shared by all parallel entry points of an osrmc_osrm_t, or of all profiles of an osrmc_profiles_t.
+ * Threads are only spawned on first use, so callers sticking to the blocking API pay nothing. */
+
+class osrmc_worker_pool final {
+public:
+  explicit osrmc_worker_pool(unsigned num_threads) : num_threads{num_threads} {}
+
+  osrmc_worker_pool(const osrmc_worker_pool&) = delete;
+  osrmc_worker_pool& operator=(const osrmc_worker_pool&) = delete;
+
+  ~osrmc_worker_pool() { stop(); }
+
+  /* Runs all submitted tasks to completion and joins the workers */
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+
+    ready.notify_all();
+
+    for (auto& thread : threads)
+      if (thread.joinable())
+        thread.join();
+  }
+
+  unsigned size() const { return num_threads; }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+
+      if (threads.empty())
+        start();
+
+      tasks.push_back(std::move(task));
+    }
+
+    ready.notify_one();
+  }
+
+  /* Runs fn(index) for all indices in [0, n), the calling thread takes part in the work.
+   * Never blocks on tasks which have not started yet, which makes nesting from within workers safe.
+   * fn must not throw. */
+  template <typename Fn>
+  void parallel_for(std::size_t n, Fn&& fn) {
+    struct state final {
+      std::atomic<std::size_t> next{0};
+      std::size_t done = 0;
+      std::mutex mutex;
+      std::condition_variable finished;
+    };
+
+    auto shared = std::make_shared<state>();
+
+    auto work = [shared, n, &fn] {
+      std::size_t completed = 0;
+
+      for (auto index = shared->next++; index < n; index = shared->next++) {
+        fn(index);
+        ++completed;
+      }
+
+      if (completed == 0)
+        return;
+
+      std::lock_guard<std::mutex> lock{shared->mutex};
+      shared->done += completed;
+
+      if (shared->done == n)
+        shared->finished.notify_all();
+    };
+
+    const auto helpers = std::min<std::size_t>(num_threads, n > 0 ? n - 1 : 0);
+
+    for (std::size_t i = 0; i < helpers; ++i)
+      submit(work);
+
+    work();
+
+    std::unique_lock<std::mutex> lock{shared->mutex};
+    shared->finished.wait(lock, [&] { return shared->done == n; });
+  }
+
+private:
+  void start() {
+    for (unsigned i = 0; i < num_threads; ++i)
+      threads.emplace_back([this] { run(); });
+  }
+
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+
+      {
+        std::unique_lock<std::mutex> lock{mutex};
+        ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+        if (tasks.empty())
+          return;
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+
+      task();
+    }
+  }
+
+  const unsigned num_threads;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+};
+
+/* Bounded LRU cache of flattened responses, sharded by key hash to keep concurrent queries off a single lock.
+ * Entries are immutable and shared, a hit only copies the flat response out.
+ * Every clear starts a new generation while holding all shard locks. Inserts pass the generation taken before their
+ * query ran and are dropped if a clear happened since, so a result computed on a replaced dataset never survives it. */
+
+template <typename Value>
+class osrmc_result_cache final {
+public:
+  explicit osrmc_result_cache(std::size_t capacity)
+      : shards(std::max<std::size_t>(1, std::min(capacity, std::size_t{max_shards}))),
+        shard_capacity{capacity / shards.size()} {}
+
+  std::shared_ptr<const Value> find(const std::string& key) {
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+
+    const auto it = shard.index.find(key);
+
+    if (it == shard.index.end()) {
+      ++misses;
+      return nullptr;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    ++hits;
+
+    return it->second->second;
+  }
+
+  unsigned long long generation() const { return current_generation.load(std::memory_order_acquire); }
+
+  void insert(const std::string& key, std::shared_ptr<const Value> value, unsigned long long generation) {
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+
+    if (generation != current_generation.load(std::memory_order_relaxed))
+      return;
+
+    const auto it = shard.index.find(key);
+
+    if (it != shard.index.end()) {
+      it->second->second = std::move(value);
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      return;
+    }
+
+    shard.entries.emplace_front(key, std::move(value));
+    shard.index.emplace(key, shard.entries.begin());
+
+    if (shard.entries.size() > shard_capacity) {
+      shard.index.erase(shard.entries.back().first);
+      shard.entries.pop_back();
+    }
+  }
+
+  void clear() {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(shards.size());
+
+    for (auto& shard : shards)
+      locks.emplace_back(shard.mutex);
+
+    current_generation.fetch_add(1, std::memory_order_release);
+
+    for (auto& shard : shards) {
+      shard.index.clear();
+      shard.entries.clear();
+    }
+  }
+
+  std::atomic<unsigned long long> hits{0};
+  std::atomic<unsigned long long> misses{0};
+
+private:
+  static const std::size_t max_shards = 16;
+
+  using entries_type = std::list<std::pair<std::string, std::shared_ptr<const Value>>>;
+
+  struct shard final {
+    std::mutex mutex;
+    entries_type entries;
+    std::unordered_map<std::string, typename entries_type::iterator> index;
+  };
+
+  shard& shard_for(const std::string& key) { return shards[std::hash<std::string>{}(key) % shards.size()]; }
+
+  std::vector<shard> shards;
+  const std::size_t shard_capacity;
+  std::atomic<unsigned long long> current_generation{0};
+};
+
+/* Single-flight coalescing of identical concurrent queries, keyed by fingerprint like the result caches.
+ * The first caller for a key leads and runs the query, callers arriving while it is in flight follow: they block on
+ * the leader's shared future and copy its outcome instead of querying the engine themselves. */
+
+template <typename Value>
+class osrmc_single_flight final {
+public:
+  /* Runs compute(out, error) unless an identical query is in flight already */
+  template <typename Compute>
+  bool run(const std::string& key, Value& out, osrmc_error_t* error, Compute&& compute) {
+    std::promise<outcome_ptr> promise;
+    std::shared_future<outcome_ptr> future;
+    bool leader = false;
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      auto it = flights.find(key);
+
+      if (it == flights.end()) {
+        future = promise.get_future().share();
+        flights.emplace(key, flight{future, 0});
+        leader = true;
+      } else {
+        future = it->second.future;
+        ++it->second.followers;
+      }
+    }
+
+    if (!leader) {
+      ++followers;
+
+      const auto result = future.get();
+
+      if (!result->ok) {
+        osrmc_error_set(error, result->status, result->message.c_str());
+        return false;
+      }
+
+      out = *result->value;
+      return true;
+    }
+
+    ++leaders;
+
+    std::shared_ptr<outcome> result{new outcome};
+
+    try {
+      result->ok = compute(out, error);
+    } catch (const std::exception& e) {
+      result->ok = false;
+      result->status = OSRMC_STATUS_EXCEPTION;
+      result->message = e.what();
+      publish(key, promise, std::move(result), out);
+      throw;
+    }
+
+    const auto ok = result->ok;
+
+    if (!ok) {
+      result->status = osrmc_status_last;
+      result->message = error && *error ? (*error)->message : osrmc_status_messages[result->status];
+    }
+
+    publish(key, promise, std::move(result), out);
+    return ok;
+  }
+
+  std::atomic<unsigned long long> leaders{0};
+  std::atomic<unsigned long long> followers{0};
+
+private:
+  struct outcome final {
+    bool ok = false;
+    std::shared_ptr<const Value> value;
+    osrmc_status_t status = OSRMC_STATUS_OK;
+    std::string message;
+  };
+
+  using outcome_ptr = std::shared_ptr<const outcome>;
+
+  struct flight final {
+    std::shared_future<outcome_ptr> future;
+    std::size_t followers;
+  };
+
+  /* Ends the flight; the response is only copied for sharing if someone actually followed */
+  void publish(const std::string& key, std::promise<outcome_ptr>& promise, std::shared_ptr<outcome> result,
+               const Value& out) {
+    std::size_t num_followers;
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      const auto it = flights.find(key);
+      num_followers = it->second.followers;
+      flights.erase(it);
+    }
+
+    if (result->ok && num_followers > 0)
+      result->value = std::make_shared<const Value>(out);
+
+    promise.set_value(std::move(result));
+  }
+
+  std::mutex mutex;
+  std::unordered_map<std::string, flight> flights;
+};
+
+/* Log-linear latency histogram in the spirit of HdrHistogram: every power of two is split into 32 linear buckets,
+ * which bounds the relative error of reported quantiles to about 3%. Recording is a single relaxed increment. */
+
+class osrmc_histogram final {
+public:
+  static const std::size_t sub_bucket_bits = 5;
+  static const std::size_t sub_buckets = std::size_t{1} << sub_bucket_bits;
+  /* Values are nanoseconds, everything above 2^40 ns (about 18 minutes) ends up in the last bucket */
+  static const std::size_t max_bits = 40;
+  static const std::size_t num_buckets = (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+  using counts_type = std::array<unsigned long long, num_buckets>;
+
+  void record(std::uint64_t value) {
+    buckets[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void copy(counts_type& counts, unsigned long long& total) const {
+    for (std::size_t i = 0; i < num_buckets; ++i)
+      counts[i] = buckets[i].load(std::memory_order_relaxed);
+
+    total = sum.load(std::memory_order_relaxed);
+  }
+
+  void reset() {
+    for (auto& bucket : buckets)
+      bucket.store(0, std::memory_order_relaxed);
+
+    sum.store(0, std::memory_order_relaxed);
+  }
+
+  /* Midpoint of the values falling into the bucket */
+  static double value_of(std::size_t index) {
+    if (index < sub_buckets)
+      return index;
+
+    const auto shift = index / sub_buckets - 1;
+    const auto lowest = static_cast<double>((index % sub_buckets + sub_buckets) << shift);
+
+    return lowest + static_cast<double>(std::uint64_t{1} << shift) / 2;
+  }
+
+private:
+  static std::size_t index_of(std::uint64_t value) {
+    const auto clamped = std::min(value, (std::uint64_t{1} << max_bits) - 1);
+
+    if (clamped < sub_buckets)
+      return static_cast<std::size_t>(clamped);
+
+    const std::size_t magnitude = 63 - __builtin_clzll(clamped) - sub_bucket_bits;
+
+    return (magnitude + 1) * sub_buckets + static_cast<std::size_t>((clamped >> magnitude) - sub_buckets);
+  }
+
+  std::array<std::atomic<unsigned long long>, num_buckets> buckets{};
+  std::atomic<unsigned long long> sum{0};
+};
+
+static const std::size_t osrmc_num_services = 5;
+
+/* Per-service counters, only allocated when stats are enabled */
+
+struct osrmc_service_stats final {
+  std::atomic<unsigned long long> calls{0};
+  std::array<std::atomic<unsigned long long>, osrmc_num_statuses> errors{};
+  osrmc_histogram engine;
+  osrmc_histogram extraction;
+};
+
+struct osrmc_stats_recorder final {
+  std::array<osrmc_service_stats, osrmc_num_services> services;
+};
+
+/* Times a single engine query: from construction to engine_done the engine, from there to extraction_done the
+ * conversion of libosrm's JSON into the flat response. Does nothing but test the recorder in each member if stats are
+ * disabled.
+ * Queries leaving without either failed or extraction_done having been called count as OSRMC_STATUS_EXCEPTION. */
+
+class osrmc_stats_timer final {
+public:
+  osrmc_stats_timer(osrmc_stats_recorder* recorder, osrmc_service_t service)
+      : stats{recorder ? &recorder->services[service] : nullptr} {
+    if (stats)
+      start = std::chrono::steady_clock::now();
+  }
+
+  ~osrmc_stats_timer() {
+    if (stats && !finished)
+      failed(OSRMC_STATUS_EXCEPTION);
+  }
+
+  void engine_done() {
+    if (!stats)
+      return;
+
+    engine_end = std::chrono::steady_clock::now();
+    stats->engine.record(elapsed(start, engine_end));
+  }
+
+  void extraction_done() {
+    if (!stats)
+      return;
+
+    stats->extraction.record(elapsed(engine_end, std::chrono::steady_clock::now()));
+    stats->calls.fetch_add(1, std::memory_order_relaxed);
+    finished = true;
+  }
+
+  void failed(osrmc_status_t status) {
+    if (!stats)
+      return;
+
+    stats->calls.fetch_add(1, std::memory_order_relaxed);
+    stats->errors[status].fetch_add(1, std::memory_order_relaxed);
+    finished = true;
+  }
+
+private:
+  static std::uint64_t elapsed(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+  }
+
+  osrmc_service_stats* stats;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point engine_end;
+  bool finished = false;
+};
+
+/* Counts a call turned away before it reached the engine, e.g. by the scheduler; there is no latency to record */
+static void osrmc_stats_rejected(osrmc_stats_recorder* recorder, osrmc_service_t service, osrmc_status_t status) {
+  if (!recorder)
+    return;
+
+  auto& stats = recorder->services[service];
+
+  stats.calls.fetch_add(1, std::memory_order_relaxed);
+  stats.errors[status].fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Fingerprints identify queries by their quantized coordinates and every setting affecting the response.
+ * Hints are left out on purpose: they only speed up snapping and do not change the result. */
+
+class osrmc_fingerprint final {
+public:
+  template <typename T>
+  osrmc_fingerprint& add(const T& value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    return *this;
+  }
+
+  template <typename T>
+  osrmc_fingerprint& add(const boost::optional<T>& value) {
+    add(static_cast<bool>(value));
+
+    if (value)
+      add(*value);
+
+    return *this;
+  }
+
+  template <typename T>
+  osrmc_fingerprint& add(const std::vector<T>& values) {
+    add(values.size());
+
+    for (const auto& value : values)
+      add(value);
+
+    return *this;
+  }
+
+  osrmc_fingerprint& add(const std::string& value) {
+    add(value.size());
+    key.append(value);
+    return *this;
+  }
+
+  osrmc_fingerprint& add(const osrm::util::Coordinate& coordinate) {
+    /* Quantized to 1e-5 degrees, roughly a meter */
+    add(static_cast<std::int32_t>(coordinate.lon) / 10);
+    add(static_cast<std::int32_t>(coordinate.lat) / 10);
+    return *this;
+  }
+
+  osrmc_fingerprint& add(const osrm::engine::Bearing& bearing) {
+    add(bearing.bearing);
+    add(bearing.range);
+    return *this;
+  }
+
+  osrmc_fingerprint& add(const osrm::engine::api::BaseParameters& params) {
+    add(params.coordinates);
+    add(params.radiuses);
+    add(params.bearings);
+    add(params.approaches);
+    add(params.exclude);
+    add(params.generate_hints);
+    return *this;
+  }
+
+  std::string key;
+};
+
+static std::string osrmc_fingerprint_of(const osrm::RouteParameters& params) {
+  osrmc_fingerprint fingerprint;
+  fingerprint.add(static_cast<const osrm::engine::api::BaseParameters&>(params));
+  fingerprint.add(params.steps).add(params.alternatives).add(params.number_of_alternatives);
+  fingerprint.add(params.annotations).add(params.annotations_type);
+  fingerprint.add(params.geometries).add(params.overview).add(params.continue_straight);
+  return fingerprint.key;
+}
+
+static std::string osrmc_fingerprint_of(const osrm::TableParameters& params) {
+  osrmc_fingerprint fingerprint;
+  fingerprint.add(static_cast<const osrm::engine::api::BaseParameters&>(params));
+  fingerprint.add(params.sources).add(params.destinations).add(params.annotations);
+  fingerprint.add(params.fallback_speed).add(params.fallback_coordinate_type).add(params.scale_factor);
+  return fingerprint.key;
+}
+
+/* Admission control for the scheduled query variants: at most max_concurrency of them run at once, the others wait
+ * in one FIFO per priority class. Interactive queries always go first and batch queries leave one slot free for them,
+ * so a long batch table can not hold back interactive routes. Queue capacity and deadlines bound the waiting. */
+
+class osrmc_scheduler final {
+public:
+  using clock = std::chrono::steady_clock;
+
+  osrmc_scheduler(unsigned max_concurrency, std::size_t queue_capacity)
+      : max_running{max_concurrency}, max_batch_running{max_concurrency - 1}, queue_capacity{queue_capacity} {}
+
+  /* A single slot leaves nothing for batch queries, they are turned away up front */
+  bool admits_batch() const { return max_batch_running > 0; }
+
+  /* Blocks until the query may start: OSRMC_STATUS_OK, or OVERLOADED / TIMEOUT if it must not run at all */
+  osrmc_status_t admit(osrmc_priority_t priority, bool has_deadline, clock::time_point deadline) {
+    const auto batch = priority == OSRMC_PRIORITY_BATCH;
+    auto& queue = batch ? batch_queue : interactive_queue;
+
+    std::unique_lock<std::mutex> lock{mutex};
+
+    if (queue.empty() && can_start(batch)) {
+      start(batch);
+      return OSRMC_STATUS_OK;
+    }
+
+    if (queue_capacity > 0 && interactive_queue.size() + batch_queue.size() >= queue_capacity)
+      return OSRMC_STATUS_OVERLOADED;
+
+    const auto ticket = next_ticket++;
+    queue.push_back(ticket);
+
+    const auto ready = [&] { return queue.front() == ticket && can_start(batch); };
+
+    if (!has_deadline)
+      changed.wait(lock, ready);
+    else if (!changed.wait_until(lock, deadline, ready)) {
+      queue.erase(std::find(queue.begin(), queue.end(), ticket));
+      lock.unlock();
+
+      /* Whoever waited behind us may be at the front now */
+      changed.notify_all();
+      return OSRMC_STATUS_TIMEOUT;
+    }
+
+    queue.pop_front();
+    start(batch);
+    lock.unlock();
+
+    /* The next in line may fit into another free slot */
+    changed.notify_all();
+    return OSRMC_STATUS_OK;
+  }
+
+  void release(osrmc_priority_t priority) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      --running;
+
+      if (priority == OSRMC_PRIORITY_BATCH)
+        --batch_running;
+    }
+
+    changed.notify_all();
+  }
+
+private:
+  bool can_start(bool batch) const {
+    if (!batch)
+      return running < max_running;
+
+    return interactive_queue.empty() && running < max_running && batch_running < max_batch_running;
+  }
+
+  void start(bool batch) {
+    ++running;
+
+    if (batch)
+      ++batch_running;
+  }
+
+  const unsigned max_running;
+  const unsigned max_batch_running;
+  const std::size_t queue_capacity;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  unsigned running = 0;
+  unsigned batch_running = 0;
+
+  std::deque<unsigned long long> interactive_queue;
+  std::deque<unsigned long long> batch_queue;
+  unsigned long long next_ticket = 0;
+};
+
+/* Holds a scheduler slot for the duration of a scheduled query */
+
+class osrmc_scheduler_slot final {
+public:
+  osrmc_scheduler_slot(osrmc_scheduler* scheduler, osrmc_priority_t priority, unsigned timeout_ms)
+      : scheduler{scheduler}, priority{priority} {
+    if (!scheduler)
+      return;
+
+    const auto deadline = osrmc_scheduler::clock::now() + std::chrono::milliseconds{timeout_ms};
+
+    status = scheduler->admit(priority, timeout_ms > 0, deadline);
+
+    /* Admitted right at the deadline: still do not touch the engine */
+    if (status == OSRMC_STATUS_OK && timeout_ms > 0 && osrmc_scheduler::clock::now() >= deadline) {
+      scheduler->release(priority);
+      status = OSRMC_STATUS_TIMEOUT;
+    }
+  }
+
+  osrmc_scheduler_slot(const osrmc_scheduler_slot&) = delete;
+  osrmc_scheduler_slot& operator=(const osrmc_scheduler_slot&) = delete;
+
+  ~osrmc_scheduler_slot() {
+    if (scheduler && status == OSRMC_STATUS_OK)
+      scheduler->release(priority);
+  }
+
+  osrmc_status_t status = OSRMC_STATUS_OK;
+
+private:
+  osrmc_scheduler* scheduler;
+  osrmc_priority_t priority;
+};
+
+struct osrmc_config final {
+  osrm::EngineConfig engine;
+  unsigned num_threads = 0;
+  std::size_t cache_capacity = 0;
+  std::size_t hint_cache_capacity = 0;
+  bool stats = false;
+  bool coalescing = false;
+  unsigned max_concurrency = 0;
+  std::size_t queue_capacity = 0;
+};
+
+static unsigned osrmc_num_threads_from(unsigned num_threads) {
+  if (num_threads > 0)
+    return num_threads;
+
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/* A loaded dataset together with the config it was loaded from.
+ * Queries hold a reference for their duration, so a reload never pulls the dataset from under them. */
+
+struct osrmc_engine final {
+  explicit osrmc_engine(const osrm::EngineConfig& engine_config) : config{engine_config}, engine{config} {}
+
+  osrm::EngineConfig config;
+  osrm::OSRM engine;
+
+  /* Counts the reloads of the osrm handle that led to this engine */
+  unsigned long long generation = 0;
+};
+
+struct osrmc_osrm final {
+  explicit osrmc_osrm(const osrmc_config& config, std::shared_ptr<osrmc_worker_pool> shared_pool = nullptr)
+      : engine{std::make_shared<osrmc_engine>(config.engine)},
+        pool{shared_pool ? std::move(shared_pool)
+                         : std::make_shared<osrmc_worker_pool>(osrmc_num_threads_from(config.num_threads))} {
+    if (config.cache_capacity > 0) {
+      route_cache.reset(new osrmc_result_cache<osrmc_route_response>{config.cache_capacity});
+      table_cache.reset(new osrmc_result_cache<osrmc_table_response>{config.cache_capacity});
+    }
+
+    if (config.hint_cache_capacity > 0)
+      hint_cache.reset(new osrmc_result_cache<osrm::engine::Hint>{config.hint_cache_capacity});
+
+    if (config.stats)
+      stats.reset(new osrmc_stats_recorder);
+
+    if (config.coalescing) {
+      route_flights.reset(new osrmc_single_flight<osrmc_route_response>);
+      table_flights.reset(new osrmc_single_flight<osrmc_table_response>);
+    }
+
+    if (config.max_concurrency > 0)
+      scheduler.reset(new osrmc_scheduler{config.max_concurrency, config.queue_capacity});
+  }
+
+  std::shared_ptr<const osrmc_engine> acquire() const { return std::atomic_load(&engine); }
+
+  /* Only ever accessed atomically, swapped by reloads */
+  std::shared_ptr<const osrmc_engine> engine;
+  std::mutex reload_mutex;
+
+  /* Only set when caching is enabled */
+  std::unique_ptr<osrmc_result_cache<osrmc_route_response>> route_cache;
+  std::unique_ptr<osrmc_result_cache<osrmc_table_response>> table_cache;
+  std::unique_ptr<osrmc_result_cache<osrm::engine::Hint>> hint_cache;
+
+  /* Only set when stats are enabled */
+  std::unique_ptr<osrmc_stats_recorder> stats;
+
+  /* Only set when coalescing is enabled */
+  std::unique_ptr<osrmc_single_flight<osrmc_route_response>> route_flights;
+  std::unique_ptr<osrmc_single_flight<osrmc_table_response>> table_flights;
+
+  /* Only set when a maximum concurrency is configured */
+  std::unique_ptr<osrmc_scheduler> scheduler;
+
+  /* Set for handles of a profiles object, which destructs them itself */
+  bool owned = false;
+
+  /* Destructed first: joins workers before the engine goes away, unless the pool is shared by several profiles */
+  std::shared_ptr<osrmc_worker_pool> pool;
+};
+
+osrmc_config_t osrmc_config_construct(const char* base_path, osrmc_error_t* error) try {
+  auto* out = new osrmc_config;
+
+  if (base_path)
+  {
+      out->engine.storage_config = osrm::StorageConfig(base_path);
+      out->engine.use_shared_memory = false;
+  }
+  else
+  {
+      out->engine.use_shared_memory = true;
+  }
+
+  return out;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_config_destruct(osrmc_config_t config) { delete config; }
+
+void osrmc_config_set_algorithm(osrmc_config_t config, osrmc_algorithm_t algorithm, osrmc_error_t* error) try {
+  switch (algorithm) {
+  case OSRMC_ALGORITHM_CH:
+    config->engine.algorithm = osrm::EngineConfig::Algorithm::CH;
+    break;
+  case OSRMC_ALGORITHM_MLD:
+    config->engine.algorithm = osrm::EngineConfig::Algorithm::MLD;
+    break;
+  default:
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown routing algorithm");
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_locations_trip(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_locations_trip = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_locations_viaroute(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_locations_viaroute = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_locations_distance_table(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_locations_distance_table = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_locations_map_matching(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_locations_map_matching = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_results_nearest(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_results_nearest = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_alternatives(osrmc_config_t config, int value, osrmc_error_t* error) try {
+  config->engine.max_alternatives = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_radius_map_matching(osrmc_config_t config, double value, osrmc_error_t* error) try {
+  config->engine.max_radius_map_matching = value;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_use_shared_memory(osrmc_config_t config, bool enable, osrmc_error_t* error) try {
+  config->engine.use_shared_memory = enable;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_use_mmap(osrmc_config_t config, bool enable, osrmc_error_t* error) try {
+  config->engine.use_mmap = enable;
+
+  if (enable)
+    config->engine.use_shared_memory = false;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_dataset_name(osrmc_config_t config, const char* name, osrmc_error_t* error) try {
+  config->engine.dataset_name = name ? name : "";
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_num_threads(osrmc_config_t config, unsigned num_threads, osrmc_error_t* error) try {
+  config->num_threads = num_threads;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_cache_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error) try {
+  config->cache_capacity = capacity;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_hint_cache_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error) try {
+  config->hint_cache_capacity = capacity;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_stats(osrmc_config_t config, bool enable, osrmc_error_t* error) try {
+  config->stats = enable;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_coalescing(osrmc_config_t config, bool enable, osrmc_error_t* error) try {
+  config->coalescing = enable;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_max_concurrency(osrmc_config_t config, unsigned max_concurrency, osrmc_error_t* error) try {
+  config->max_concurrency = max_concurrency;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_config_set_queue_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error) try {
+  config->queue_capacity = capacity;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+osrmc_osrm_t osrmc_osrm_construct(osrmc_config_t config, osrmc_error_t* error) try {
+  return new osrmc_osrm{*config};
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_osrm_destruct(osrmc_osrm_t osrm) {
+  /* Profile handles are released by the profiles' destruct */
+  if (osrm && osrm->owned)
+    return;
+
+  delete osrm;
+}
+
+void osrmc_osrm_cache_clear(osrmc_osrm_t osrm) {
+  if (osrm->route_cache)
+    osrm->route_cache->clear();
+
+  if (osrm->table_cache)
+    osrm->table_cache->clear();
+
+  if (osrm->hint_cache)
+    osrm->hint_cache->clear();
+}
+
+void osrmc_osrm_reload(osrmc_osrm_t osrm, osrmc_config_t config, double* load_seconds, osrmc_error_t* error) try {
+  std::lock_guard<std::mutex> lock{osrm->reload_mutex};
+
+  const auto start = std::chrono::steady_clock::now();
+
+  auto loaded = std::make_shared<osrmc_engine>(config->engine);
+  loaded->generation = osrm->acquire()->generation + 1;
+
+  if (load_seconds)
+    *load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  /* Queries still running on the previous dataset keep it alive until they finish */
+  std::atomic_store(&osrm->engine, std::shared_ptr<const osrmc_engine>{std::move(loaded)});
+
+  osrmc_osrm_cache_clear(osrm);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Warm-up pulls the dataset files of mmap-backed engines into the page cache in parallel chunks, most latency-critical
+ * files first: the R-tree, then the graph, then names and everything else. Reading the chunks instead of just advising
+ * the kernel makes sure the pages are resident when warm-up returns; queries afterwards only take minor faults. */
+
+static const std::size_t osrmc_warmup_chunk_size = std::size_t{8} << 20;
+static const std::size_t osrmc_warmup_block_size = std::size_t{1} << 20;
+
+static bool osrmc_ends_with(const std::string& file, const char* suffix) {
+  const auto length = std::strlen(suffix);
+  return file.size() >= length && file.compare(file.size() - length, length, suffix) == 0;
+}
+
+static int osrmc_warmup_rank(const std::string& file) {
+  static const char* const suffixes[] = {".osrm.ramIndex", ".osrm.fileIndex", ".osrm.hsgr", ".osrm.mldgr",
+                                         ".osrm.cells",    ".osrm.cell_metrics", ".osrm.names"};
+
+  const auto num_suffixes = static_cast<int>(sizeof(suffixes) / sizeof(suffixes[0]));
+
+  for (int i = 0; i < num_suffixes; ++i)
+    if (osrmc_ends_with(file, suffixes[i]))
+      return i;
+
+  return num_suffixes;
+}
+
+/* Whether the engine loads or maps the dataset file: extraction intermediates and the other algorithm's files stay
+ * on disk */
+static bool osrmc_dataset_file_used(const std::string& file, osrm::EngineConfig::Algorithm algorithm) {
+  static const char* const intermediates[] = {".osrm",      ".osrm.ebg",          ".osrm.enw",
+                                              ".osrm.cnbg", ".osrm.cnbg_to_ebg",  ".osrm.restrictions",
+                                              ".osrm.turn_penalties_index"};
+  static const char* const ch[] = {".osrm.hsgr"};
+  static const char* const mld[] = {".osrm.partition", ".osrm.cells", ".osrm.cell_metrics", ".osrm.mldgr"};
+
+  const auto is_any = [&](const char* const* suffixes, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      if (osrmc_ends_with(file, suffixes[i]))
+        return true;
+
+    return false;
+  };
+
+  if (is_any(intermediates, sizeof(intermediates) / sizeof(intermediates[0])))
+    return false;
+
+  if (algorithm == osrm::EngineConfig::Algorithm::CH)
+    return !is_any(mld, sizeof(mld) / sizeof(mld[0]));
+
+  return !is_any(ch, sizeof(ch) / sizeof(ch[0]));
+}
+
+/* All <base>.osrm* files with their sizes, in warm-up order */
+static std::vector<std::pair<std::string, std::size_t>> osrmc_warmup_files(const std::string& base_path) {
+  auto prefix = base_path;
+
+  if (prefix.size() >= 5 && prefix.compare(prefix.size() - 5, 5, ".osrm") == 0)
+    prefix.resize(prefix.size() - 5);
+
+  const auto slash = prefix.rfind('/');
+  const auto directory = slash == std::string::npos ? std::string{"."} : prefix.substr(0, slash + 1);
+  const auto stem = (slash == std::string::npos ? prefix : prefix.substr(slash + 1)) + ".osrm";
+
+  DIR* entries = ::opendir(directory.c_str());
+
+  if (!entries)
+    throw std::runtime_error{"Dataset directory not readable: " + directory};
+
+  std::vector<std::pair<std::string, std::size_t>> files;
+
+  while (const auto* entry = ::readdir(entries)) {
+    const std::string name = entry->d_name;
+
+    if (name.compare(0, stem.size(), stem) != 0)
+      continue;
+
+    const auto path = (slash == std::string::npos ? name : directory + name);
+
+    struct stat info;
+
+    if (::stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+      files.emplace_back(path, static_cast<std::size_t>(info.st_size));
+  }
+
+  ::closedir(entries);
+
+  std::sort(files.begin(), files.end(), [](const std::pair<std::string, std::size_t>& lhs,
+                                           const std::pair<std::string, std::size_t>& rhs) {
+    const auto lhs_rank = osrmc_warmup_rank(lhs.first);
+    const auto rhs_rank = osrmc_warmup_rank(rhs.first);
+    return lhs_rank != rhs_rank ? lhs_rank < rhs_rank : lhs.first < rhs.first;
+  });
+
+  return files;
+}
+
+void osrmc_osrm_warmup(osrmc_osrm_t osrm, size_t byte_budget, unsigned time_budget_ms, size_t* warmed_bytes,
+                       osrmc_error_t* error) try {
+  using clock = std::chrono::steady_clock;
+
+  const auto deadline = clock::now() + std::chrono::milliseconds{time_budget_ms};
+
+  if (warmed_bytes)
+    *warmed_bytes = 0;
+
+  const auto engine = osrm->acquire();
+
+  const auto& config = engine->config;
+  const auto base_path = config.storage_config.base_path.string();
+
+  /* Shared memory loaded from osrm-datastore by name only: the dataset files can not be located */
+  if (base_path.empty()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Warm-up needs the dataset's base path to locate its files");
+    return;
+  }
+
+  struct chunk final {
+    const std::string* path;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  /* The R-tree leaves in .fileIndex are mmapped in every mode; the other files are resident already in private and
+   * shared memory and only need touching when mmapped */
+  auto files = osrmc_warmup_files(base_path);
+
+  const auto cold = [&](const std::pair<std::string, std::size_t>& file) {
+    if (osrmc_ends_with(file.first, ".osrm.fileIndex"))
+      return true;
+
+    return config.use_mmap && !config.use_shared_memory && osrmc_dataset_file_used(file.first, config.algorithm);
+  };
+
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [&](const std::pair<std::string, std::size_t>& file) { return !cold(file); }),
+              files.end());
+
+  std::vector<chunk> chunks;
+  std::size_t planned = 0;
+
+  for (const auto& file : files) {
+    for (std::size_t offset = 0; offset < file.second; offset += osrmc_warmup_chunk_size) {
+      auto size = std::min(osrmc_warmup_chunk_size, file.second - offset);
+
+      if (byte_budget > 0)
+        size = std::min(size, byte_budget - planned);
+
+      if (size == 0)
+        break;
+
+      chunks.push_back({&file.first, offset, size});
+      planned += size;
+    }
+  }
+
+  std::atomic<std::size_t> warmed{0};
+
+  osrmc_first_failure failure{error};
+
+  osrm->pool->parallel_for(chunks.size(), [&](std::size_t index) {
+    const auto& each = chunks[index];
+
+    if (time_budget_ms > 0 && clock::now() >= deadline)
+      return;
+
+    osrmc_error_t chunk_error = nullptr;
+
+    try {
+      std::unique_ptr<char[]> block{new char[osrmc_warmup_block_size]};
+
+      const auto fd = ::open(each.path->c_str(), O_RDONLY | O_CLOEXEC);
+
+      if (fd < 0)
+        throw std::runtime_error{"Dataset file not readable: " + *each.path};
+
+      ::posix_fadvise(fd, each.offset, each.size, POSIX_FADV_WILLNEED);
+
+      std::size_t done = 0;
+
+      while (done < each.size && (time_budget_ms == 0 || clock::now() < deadline)) {
+        const auto wanted = std::min(osrmc_warmup_block_size, each.size - done);
+        const auto got = ::pread(fd, block.get(), wanted, each.offset + done);
+
+        if (got < 0 && errno == EINTR)
+          continue;
+
+        if (got <= 0)
+          break;
+
+        done += static_cast<std::size_t>(got);
+      }
+
+      ::close(fd);
+
+      warmed.fetch_add(done, std::memory_order_relaxed);
+    } catch (const std::exception& e) {
+      failure.record(osrmc_error_from_exception(e, failure.details_for(chunk_error)), chunk_error);
+    }
+  });
+
+  if (warmed_bytes)
+    *warmed_bytes = warmed;
+
+  failure.report(error);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_osrm_cache_stats(osrmc_osrm_t osrm, unsigned long long* hits, unsigned long long* misses) {
+  *hits = 0;
+  *misses = 0;
+
+  if (osrm->route_cache) {
+    *hits += osrm->route_cache->hits;
+    *misses += osrm->route_cache->misses;
+  }
+
+  if (osrm->table_cache) {
+    *hits += osrm->table_cache->hits;
+    *misses += osrm->table_cache->misses;
+  }
+}
+
+void osrmc_osrm_coalescing_stats(osrmc_osrm_t osrm, unsigned long long* leaders, unsigned long long* followers) {
+  *leaders = 0;
+  *followers = 0;
+
+  if (osrm->route_flights) {
+    *leaders += osrm->route_flights->leaders;
+    *followers += osrm->route_flights->followers;
+  }
+
+  if (osrm->table_flights) {
+    *leaders += osrm->table_flights->leaders;
+    *followers += osrm->table_flights->followers;
+  }
+}
+
+/* Several datasets, typically one per profile, served from one process. Their osrm handles share a single worker pool,
+ * so batch functions of all profiles together never run more workers than configured. */
+
+struct osrmc_profiles final {
+  struct profile final {
+    std::string name;
+    std::unique_ptr<osrmc_osrm> osrm;
+    std::size_t memory;
+  };
+
+  explicit osrmc_profiles(unsigned num_threads)
+      : pool{std::make_shared<osrmc_worker_pool>(osrmc_num_threads_from(num_threads))} {}
+
+  /* Drains tasks of all profiles before any of their handles goes away */
+  ~osrmc_profiles() { pool->stop(); }
+
+  std::shared_ptr<osrmc_worker_pool> pool;
+
+  /* Profiles are only ever appended and stay put */
+  std::mutex mutex;
+  std::vector<std::unique_ptr<profile>> profiles;
+};
+
+/* Size of the dataset files the engine loads or maps; datasets in shared memory are owned by osrm-datastore */
+static std::size_t osrmc_dataset_bytes(const osrm::EngineConfig& config) {
+  if (config.use_shared_memory)
+    return 0;
+
+  std::size_t bytes = 0;
+
+  for (const auto& file : osrmc_warmup_files(config.storage_config.base_path.string()))
+    if (osrmc_dataset_file_used(file.first, config.algorithm))
+      bytes += file.second;
+
+  return bytes;
+}
+
+osrmc_profiles_t osrmc_profiles_construct(unsigned num_threads, osrmc_error_t* error) try {
+  return new osrmc_profiles{num_threads};
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_profiles_destruct(osrmc_profiles_t profiles) { delete profiles; }
+
+static bool osrmc_profiles_taken(const osrmc_profiles& profiles, const char* name) {
+  for (const auto& profile : profiles.profiles)
+    if (profile->name == name)
+      return true;
+
+  return false;
+}
+
+size_t osrmc_profiles_add(osrmc_profiles_t profiles, const char* name, osrmc_config_t config,
+                          osrmc_error_t* error) try {
+  {
+    std::lock_guard<std::mutex> lock{profiles->mutex};
+
+    if (osrmc_profiles_taken(*profiles, name)) {
+      osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Profile name already taken");
+      return profiles->profiles.size();
+    }
+  }
+
+  /* Loading takes long, queries and lookups of other profiles go on meanwhile */
+  std::unique_ptr<osrmc_osrm> osrm{new osrmc_osrm{*config, profiles->pool}};
+  osrm->owned = true;
+  const auto memory = osrmc_dataset_bytes(config->engine);
+
+  std::lock_guard<std::mutex> lock{profiles->mutex};
+
+  /* Concurrently added under the same name while loading */
+  if (osrmc_profiles_taken(*profiles, name)) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Profile name already taken");
+    return profiles->profiles.size();
+  }
+
+  profiles->profiles.emplace_back(new osrmc_profiles::profile{name, std::move(osrm), memory});
+  return profiles->profiles.size() - 1;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+
+  std::lock_guard<std::mutex> lock{profiles->mutex};
+  return profiles->profiles.size();
+}
+
+size_t osrmc_profiles_count(osrmc_profiles_t profiles) {
+  std::lock_guard<std::mutex> lock{profiles->mutex};
+  return profiles->profiles.size();
+}
+
+size_t osrmc_profiles_find(osrmc_profiles_t profiles, const char* name, osrmc_error_t* error) {
+  std::lock_guard<std::mutex> lock{profiles->mutex};
+
+  for (std::size_t i = 0; i < profiles->profiles.size(); ++i)
+    if (profiles->profiles[i]->name == name)
+      return i;
+
+  osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown profile name");
+  return profiles->profiles.size();
+}
+
+static const osrmc_profiles::profile* osrmc_profiles_profile(osrmc_profiles_t profiles, size_t id,
+                                                             osrmc_error_t* error) {
+  std::lock_guard<std::mutex> lock{profiles->mutex};
+
+  if (id >= profiles->profiles.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Profile id out of range");
+    return nullptr;
+  }
+
+  return profiles->profiles[id].get();
+}
+
+osrmc_osrm_t osrmc_profiles_osrm(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error) {
+  const auto* profile = osrmc_profiles_profile(profiles, id, error);
+  return profile ? profile->osrm.get() : nullptr;
+}
+
+const char* osrmc_profiles_name(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error) {
+  const auto* profile = osrmc_profiles_profile(profiles, id, error);
+  return profile ? profile->name.c_str() : nullptr;
+}
+
+size_t osrmc_profiles_memory(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error) {
+  const auto* profile = osrmc_profiles_profile(profiles, id, error);
+  return profile ? profile->memory : 0;
+}
+
+/* Stats snapshots are plain copies of the counters, taken without stopping queries */
+
+struct osrmc_stats final {
+  struct histogram final {
+    osrmc_histogram::counts_type counts;
+    unsigned long long count;
+    unsigned long long sum;
+  };
+
+  struct service final {
+    unsigned long long calls;
+    std::array<unsigned long long, osrmc_num_statuses> errors;
+    histogram engine;
+    histogram extraction;
+  };
+
+  std::array<service, osrmc_num_services> services;
+};
+
+static void osrmc_stats_copy(const osrmc_histogram& from, osrmc_stats::histogram& into) {
+  from.copy(into.counts, into.sum);
+  into.count = std::accumulate(into.counts.begin(), into.counts.end(), 0ull);
+}
+
+osrmc_stats_t osrmc_stats_snapshot(osrmc_osrm_t osrm, osrmc_error_t* error) try {
+  if (!osrm->stats) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_OPTIONS, "Stats are not enabled in the config");
+    return nullptr;
+  }
+
+  std::unique_ptr<osrmc_stats> out{new osrmc_stats};
+
+  for (std::size_t i = 0; i < osrmc_num_services; ++i) {
+    const auto& from = osrm->stats->services[i];
+    auto& into = out->services[i];
+
+    into.calls = from.calls.load(std::memory_order_relaxed);
+
+    for (std::size_t status = 0; status < osrmc_num_statuses; ++status)
+      into.errors[status] = from.errors[status].load(std::memory_order_relaxed);
+
+    osrmc_stats_copy(from.engine, into.engine);
+    osrmc_stats_copy(from.extraction, into.extraction);
+  }
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_stats_destruct(osrmc_stats_t stats) { delete stats; }
+
+void osrmc_osrm_stats_reset(osrmc_osrm_t osrm) {
+  if (!osrm->stats)
+    return;
+
+  for (auto& service : osrm->stats->services) {
+    service.calls.store(0, std::memory_order_relaxed);
+
+    for (auto& errors : service.errors)
+      errors.store(0, std::memory_order_relaxed);
+
+    service.engine.reset();
+    service.extraction.reset();
+  }
+}
+
+static const osrmc_stats::service* osrmc_stats_service(osrmc_stats_t stats, osrmc_service_t service) {
+  if (static_cast<std::size_t>(service) >= osrmc_num_services)
+    return nullptr;
+
+  return &stats->services[service];
+}
+
+unsigned long long osrmc_stats_calls(osrmc_stats_t stats, osrmc_service_t service) {
+  const auto* typed = osrmc_stats_service(stats, service);
+  return typed ? typed->calls : 0;
+}
+
+unsigned long long osrmc_stats_errors(osrmc_stats_t stats, osrmc_service_t service, osrmc_status_t status) {
+  const auto* typed = osrmc_stats_service(stats, service);
+
+  if (!typed || static_cast<std::size_t>(status) >= osrmc_num_statuses)
+    return 0;
+
+  if (status != OSRMC_STATUS_OK)
+    return typed->errors[status];
+
+  return std::accumulate(typed->errors.begin(), typed->errors.end(), 0ull);
+}
+
+static double osrmc_stats_quantile(const osrmc_stats::histogram& histogram, double quantile) {
+  if (histogram.count == 0)
+    return NAN;
+
+  const auto clamped = std::min(std::max(quantile, 0.), 1.);
+  const auto rank = std::max(1ull, static_cast<unsigned long long>(std::ceil(clamped * histogram.count)));
+
+  unsigned long long seen = 0;
+  std::size_t index = 0;
+
+  while ((seen += histogram.counts[index]) < rank)
+    ++index;
+
+  return osrmc_histogram::value_of(index) / 1e9;
+}
+
+double osrmc_stats_engine_seconds(osrmc_stats_t stats, osrmc_service_t service, double quantile) {
+  const auto* typed = osrmc_stats_service(stats, service);
+  return typed ? osrmc_stats_quantile(typed->engine, quantile) : NAN;
+}
+
+double osrmc_stats_extraction_seconds(osrmc_stats_t stats, osrmc_service_t service, double quantile) {
+  const auto* typed = osrmc_stats_service(stats, service);
+  return typed ? osrmc_stats_quantile(typed->extraction, quantile) : NAN;
+}
+
+double osrmc_stats_engine_total_seconds(osrmc_stats_t stats, osrmc_service_t service) {
+  const auto* typed = osrmc_stats_service(stats, service);
+  return typed ? typed->engine.sum / 1e9 : 0.;
+}
+
+double osrmc_stats_extraction_total_seconds(osrmc_stats_t stats, osrmc_service_t service) {
+  const auto* typed = osrmc_stats_service(stats, service);
+  return typed ? typed->extraction.sum / 1e9 : 0.;
+}
+
+/* Completions are counted by a semaphore eventfd: readable for as long as the deque is not empty.
+ * Queued queries hold a reference until they pushed their completion, so the queue outlives its destruct call until
+ * the last of them is done; their completions then get destructed along with it. */
+
+struct osrmc_completion_queue final {
+  struct completion final {
+    void* data;
+    void* response;
+    void (*response_destruct)(void*);
+    osrmc_error_t error;
+  };
+
+  osrmc_completion_queue() : fd{::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)} {
+    if (fd == -1)
+      throw std::runtime_error{std::string{"Unable to create eventfd: "} + std::strerror(errno)};
+  }
+
+  ~osrmc_completion_queue() {
+    for (const auto& completion : completions) {
+      if (completion.response)
+        completion.response_destruct(completion.response);
+
+      delete completion.error;
+    }
+
+    ::close(fd);
+  }
+
+  osrmc_completion_queue(const osrmc_completion_queue&) = delete;
+  osrmc_completion_queue& operator=(const osrmc_completion_queue&) = delete;
+
+  void retain() { references.fetch_add(1, std::memory_order_relaxed); }
+
+  void release() {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  void push(completion next) {
+    std::lock_guard<std::mutex> lock{mutex};
+    completions.push_back(next);
+
+    const std::uint64_t one = 1;
+    (void)!::write(fd, &one, sizeof(one));
+  }
+
+  bool pop(completion& next) {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    if (completions.empty())
+      return false;
+
+    next = completions.front();
+    completions.pop_front();
+
+    std::uint64_t one;
+    (void)!::read(fd, &one, sizeof(one));
+
+    return true;
+  }
+
+  const int fd;
+
+  std::mutex mutex;
+  std::deque<completion> completions;
+
+  /* The owner's reference plus one per queued query still pending */
+  std::atomic<std::size_t> references{1};
+};
+
+osrmc_completion_queue_t osrmc_completion_queue_construct(osrmc_error_t* error) try {
+  return new osrmc_completion_queue;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_completion_queue_destruct(osrmc_completion_queue_t queue) { queue->release(); }
+
+int osrmc_completion_queue_fd(osrmc_completion_queue_t queue) { return queue->fd; }
+
+bool osrmc_completion_queue_pop(osrmc_completion_queue_t queue, void** data, void** response,
+                                osrmc_error_t* response_error) {
+  osrmc_completion_queue::completion next;
+
+  if (!queue->pop(next))
+    return false;
+
+  *data = next.data;
+  *response = next.response;
+  *response_error = next.error;
+
+  return true;
+}
+
+/* Per-coordinate settings are either empty or line up with coordinates: pad the set ones with defaults */
+static void osrmc_params_pad(osrm::engine::api::BaseParameters& params) {
+  const auto size = params.coordinates.size();
+
+  if (!params.hints.empty())
+    params.hints.resize(size);
+
+  if (!params.radiuses.empty())
+    params.radiuses.resize(size);
+
+  if (!params.bearings.empty())
+    params.bearings.resize(size);
+
+  if (!params.approaches.empty())
+    params.approaches.resize(size);
+}
+
+void osrmc_params_add_coordinate(osrmc_params_t params, float longitude, float latitude, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+
+  auto longitude_typed = osrm::util::FloatLongitude{longitude};
+  auto latitude_typed = osrm::util::FloatLatitude{latitude};
+
+  params_typed->coordinates.emplace_back(std::move(longitude_typed), std::move(latitude_typed));
+
+  osrmc_params_pad(*params_typed);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_params_add_coordinate_with(osrmc_params_t params, float longitude, float latitude, float radius, int bearing,
+                                      int range, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+
+  auto longitude_typed = osrm::util::FloatLongitude{longitude};
+  auto latitude_typed = osrm::util::FloatLatitude{latitude};
+
+  osrm::engine::Bearing bearing_typed{static_cast<short>(bearing), static_cast<short>(range)};
+
+  /* Coordinates added without radius and bearing get the defaults */
+  params_typed->radiuses.resize(params_typed->coordinates.size());
+  params_typed->bearings.resize(params_typed->coordinates.size());
+
+  params_typed->coordinates.emplace_back(std::move(longitude_typed), std::move(latitude_typed));
+  params_typed->radiuses.emplace_back(radius);
+  params_typed->bearings.emplace_back(std::move(bearing_typed));
+
+  osrmc_params_pad(*params_typed);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_params_set_hint(osrmc_params_t params, size_t index, const char* hint, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+
+  if (index >= params_typed->coordinates.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Hint index out of range of coordinates");
+    return;
+  }
+
+  params_typed->hints.resize(params_typed->coordinates.size());
+
+  if (hint && *hint)
+    params_typed->hints[index] = osrm::engine::Hint::FromBase64(hint);
+  else
+    params_typed->hints[index] = boost::none;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_params_add_coordinates(osrmc_params_t params, const float* longitudes, const float* latitudes, size_t n,
+                                  const float* radiuses, const int* bearings, const int* ranges,
+                                  osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+
+  if ((bearings == nullptr) != (ranges == nullptr)) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Bearings and ranges have to be passed together");
+    return;
+  }
+
+  const auto size = params_typed->coordinates.size();
+
+  params_typed->coordinates.reserve(size + n);
+
+  for (std::size_t i = 0; i < n; ++i)
+    params_typed->coordinates.emplace_back(osrm::util::FloatLongitude{longitudes[i]},
+                                           osrm::util::FloatLatitude{latitudes[i]});
+
+  /* Radiuses and bearings have to line up with coordinates: pad previously added coordinates with defaults */
+  if (radiuses || !params_typed->radiuses.empty()) {
+    params_typed->radiuses.reserve(size + n);
+    params_typed->radiuses.resize(size);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      if (radiuses)
+        params_typed->radiuses.emplace_back(radiuses[i]);
+      else
+        params_typed->radiuses.emplace_back();
+    }
+  }
+
+  if (bearings || !params_typed->bearings.empty()) {
+    params_typed->bearings.reserve(size + n);
+    params_typed->bearings.resize(size);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      if (bearings)
+        params_typed->bearings.emplace_back(
+            osrm::engine::Bearing{static_cast<short>(bearings[i]), static_cast<short>(ranges[i])});
+      else
+        params_typed->bearings.emplace_back();
+    }
+  }
+
+  osrmc_params_pad(*params_typed);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Resetting swaps the vectors out, restores the defaults and moves the cleared vectors back in to keep capacity */
+
+template <typename T>
+static void osrmc_params_stash(std::vector<T>& from, std::vector<T>& into) {
+  into = std::move(from);
+  into.clear();
+}
+
+struct osrmc_base_params_storage final {
+  explicit osrmc_base_params_storage(osrm::engine::api::BaseParameters& params) {
+    osrmc_params_stash(params.coordinates, coordinates);
+    osrmc_params_stash(params.hints, hints);
+    osrmc_params_stash(params.radiuses, radiuses);
+    osrmc_params_stash(params.bearings, bearings);
+    osrmc_params_stash(params.approaches, approaches);
+  }
+
+  void restore(osrm::engine::api::BaseParameters& params) {
+    params.coordinates = std::move(coordinates);
+    params.hints = std::move(hints);
+    params.radiuses = std::move(radiuses);
+    params.bearings = std::move(bearings);
+    params.approaches = std::move(approaches);
+  }
+
+  decltype(osrm::engine::api::BaseParameters::coordinates) coordinates;
+  decltype(osrm::engine::api::BaseParameters::hints) hints;
+  decltype(osrm::engine::api::BaseParameters::radiuses) radiuses;
+  decltype(osrm::engine::api::BaseParameters::bearings) bearings;
+  decltype(osrm::engine::api::BaseParameters::approaches) approaches;
+};
+
+static void osrmc_params_reset_typed(osrm::RouteParameters& params) {
+  osrmc_base_params_storage storage{params};
+  params = osrm::RouteParameters{};
+  storage.restore(params);
+}
+
+static void osrmc_params_reset_typed(osrm::TableParameters& params) {
+  osrmc_base_params_storage storage{params};
+
+  decltype(params.sources) sources;
+  decltype(params.destinations) destinations;
+  osrmc_params_stash(params.sources, sources);
+  osrmc_params_stash(params.destinations, destinations);
+
+  params = osrm::TableParameters{};
+
+  storage.restore(params);
+  params.sources = std::move(sources);
+  params.destinations = std::move(destinations);
+}
+
+static void osrmc_params_reset_typed(osrm::NearestParameters& params) {
+  osrmc_base_params_storage storage{params};
+  params = osrm::NearestParameters{};
+  storage.restore(params);
+}
+
+static void osrmc_params_reset_typed(osrm::MatchParameters& params) {
+  osrmc_base_params_storage storage{params};
+
+  decltype(params.timestamps) timestamps;
+  osrmc_params_stash(params.timestamps, timestamps);
+
+  params = osrm::MatchParameters{};
+
+  storage.restore(params);
+  params.timestamps = std::move(timestamps);
+}
+
+static void osrmc_params_reset_typed(osrm::TripParameters& params) {
+  osrmc_base_params_storage storage{params};
+
+  params = osrm::TripParameters{};
+
+  storage.restore(params);
+}
+
+/* Per-thread free lists of reset parameters objects, bounded to not hoard memory */
+
+template <typename Parameters>
+class osrmc_params_pool final {
+public:
+  static Parameters* acquire() {
+    auto& params = free_list().params;
+
+    if (params.empty())
+      return new Parameters;
+
+    auto* out = params.back();
+    params.pop_back();
+
+    return out;
+  }
+
+  static void release(Parameters* released) {
+    if (!released)
+      return;
+
+    auto& params = free_list().params;
+
+    if (params.size() >= max_pooled) {
+      delete released;
+      return;
+    }
+
+    osrmc_params_reset_typed(*released);
+
+    params.reserve(max_pooled);
+    params.push_back(released);
+  }
+
+private:
+  static const std::size_t max_pooled = 32;
+
+  struct pooled final {
+    ~pooled() {
+      for (auto* each : params)
+        delete each;
+    }
+
+    std::vector<Parameters*> params;
+  };
+
+  static pooled& free_list() {
+    static thread_local pooled list;
+    return list;
+  }
+};
+
+/* Appends coordinate index of from to into, together with its per-coordinate settings if from has them */
+
+static void osrmc_params_copy_coordinate(const osrm::engine::api::BaseParameters& from, std::size_t index,
+                                         osrm::engine::api::BaseParameters& into) {
+  into.coordinates.push_back(from.coordinates.at(index));
+
+  if (!from.hints.empty())
+    into.hints.push_back(from.hints.at(index));
+
+  if (!from.radiuses.empty())
+    into.radiuses.push_back(from.radiuses.at(index));
+
+  if (!from.bearings.empty())
+    into.bearings.push_back(from.bearings.at(index));
+
+  if (!from.approaches.empty())
+    into.approaches.push_back(from.approaches.at(index));
+}
+
+osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::RouteParameters;
+
+  return reinterpret_cast<osrmc_route_params_t>(out);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_route_params_destruct(osrmc_route_params_t params) {
+  delete reinterpret_cast<osrm::RouteParameters*>(params);
+}
+
+void osrmc_route_params_reset(osrmc_route_params_t params) {
+  osrmc_params_reset_typed(*reinterpret_cast<osrm::RouteParameters*>(params));
+}
+
+osrmc_route_params_t osrmc_route_params_acquire(osrmc_error_t* error) try {
+  return reinterpret_cast<osrmc_route_params_t>(osrmc_params_pool<osrm::RouteParameters>::acquire());
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_route_params_release(osrmc_route_params_t params) {
+  osrmc_params_pool<osrm::RouteParameters>::release(reinterpret_cast<osrm::RouteParameters*>(params));
+}
+
+void osrmc_route_params_add_steps(osrmc_route_params_t params, int on) {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+  params_typed->steps = on;
+}
+
+void osrmc_route_params_add_alternatives(osrmc_route_params_t params, int on) {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+  params_typed->alternatives = on;
+}
+
+void osrmc_route_params_set_overview(osrmc_route_params_t params, osrmc_overview_t overview, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  switch (overview) {
+  case OSRMC_OVERVIEW_SIMPLIFIED:
+    params_typed->overview = osrm::RouteParameters::OverviewType::Simplified;
+    break;
+  case OSRMC_OVERVIEW_FULL:
+    params_typed->overview = osrm::RouteParameters::OverviewType::Full;
+    break;
+  case OSRMC_OVERVIEW_FALSE:
+    params_typed->overview = osrm::RouteParameters::OverviewType::False;
+    break;
+  default:
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown overview");
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_params_set_geometries(osrmc_route_params_t params, osrmc_geometries_t geometries,
+                                       osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  switch (geometries) {
+  case OSRMC_GEOMETRIES_POLYLINE:
+    params_typed->geometries = osrm::RouteParameters::GeometriesType::Polyline;
+    break;
+  case OSRMC_GEOMETRIES_POLYLINE6:
+    params_typed->geometries = osrm::RouteParameters::GeometriesType::Polyline6;
+    break;
+  case OSRMC_GEOMETRIES_GEOJSON:
+    params_typed->geometries = osrm::RouteParameters::GeometriesType::GeoJSON;
+    break;
+  default:
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown geometries");
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_params_set_annotations(osrmc_route_params_t params, unsigned annotations, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  using AnnotationsType = osrm::RouteParameters::AnnotationsType;
+
+  if (annotations & ~static_cast<unsigned>(OSRMC_ROUTE_ANNOTATIONS_ALL)) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown annotations");
+    return;
+  }
+
+  auto typed = AnnotationsType::None;
+
+  if (annotations & OSRMC_ROUTE_ANNOTATIONS_DURATION)
+    typed |= AnnotationsType::Duration;
+
+  if (annotations & OSRMC_ROUTE_ANNOTATIONS_DISTANCE)
+    typed |= AnnotationsType::Distance;
+
+  if (annotations & OSRMC_ROUTE_ANNOTATIONS_SPEED)
+    typed |= AnnotationsType::Speed;
+
+  if (annotations & OSRMC_ROUTE_ANNOTATIONS_NODES)
+    typed |= AnnotationsType::Nodes;
+
+  params_typed->annotations = annotations != 0;
+  params_typed->annotations_type = typed;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Hint cache: remembers the hints libosrm returns per input coordinate and attaches them to later queries.
+ * Hints only stay valid for the exact input coordinate, and only carry over when snapping is unconstrained. */
+
+static bool osrmc_hint_cacheable(const osrm::engine::api::BaseParameters& params, std::size_t index) {
+  if (!params.exclude.empty())
+    return false;
+
+  if (!params.radiuses.empty() && params.radiuses[index])
+    return false;
+
+  if (!params.bearings.empty() && params.bearings[index])
+    return false;
+
+  if (!params.approaches.empty() && params.approaches[index])
+    return false;
+
+  return true;
+}
+
+static bool osrmc_hint_present(const osrm::engine::api::BaseParameters& params, std::size_t index) {
+  return !params.hints.empty() && params.hints[index];
+}
+
+static std::string osrmc_hint_key(const osrm::util::Coordinate& coordinate) {
+  const std::int32_t fixed[] = {static_cast<std::int32_t>(coordinate.lon), static_cast<std::int32_t>(coordinate.lat)};
+  return std::string(reinterpret_cast<const char*>(fixed), sizeof(fixed));
+}
+
+/* Returns params itself if no cached hint applies, otherwise a copy in storage with hints attached */
+template <typename Parameters>
+static const Parameters& osrmc_hints_apply(osrmc_osrm_t osrm, const Parameters& params, Parameters& storage) {
+  if (!osrm->hint_cache)
+    return params;
+
+  auto applied = false;
+
+  for (std::size_t i = 0; i < params.coordinates.size(); ++i) {
+    if (osrmc_hint_present(params, i) || !osrmc_hint_cacheable(params, i))
+      continue;
+
+    const auto hint = osrm->hint_cache->find(osrmc_hint_key(params.coordinates[i]));
+
+    if (!hint)
+      continue;
+
+    if (!applied) {
+      storage = params;
+      storage.hints.resize(storage.coordinates.size());
+      applied = true;
+    }
+
+    storage.hints[i] = *hint;
+  }
+
+  return applied ? storage : params;
+}
+
+/* Taken before a query picks its dataset, so hints of a dataset replaced by a reload in the meantime are dropped */
+static unsigned long long osrmc_hints_generation(osrmc_osrm_t osrm) {
+  return osrm->hint_cache ? osrm->hint_cache->generation() : 0;
+}
+
+static void osrmc_hints_store(osrmc_osrm_t osrm, const osrm::engine::api::BaseParameters& params, std::size_t index,
+                              const std::string& hint, unsigned long long generation) {
+  if (!osrm->hint_cache || hint.empty() || index >= params.coordinates.size())
+    return;
+
+  if (osrmc_hint_present(params, index) || !osrmc_hint_cacheable(params, index))
+    return;
+
+  auto decoded = std::make_shared<const osrm::engine::Hint>(osrm::engine::Hint::FromBase64(hint));
+  osrm->hint_cache->insert(osrmc_hint_key(params.coordinates[index]), std::move(decoded), generation);
+}
+
+static void osrmc_waypoint_hints_from_json(const osrm::json::Value& json, std::vector<std::string>& out) {
+  const auto& waypoints = json.get<osrm::json::Array>().values;
+
+  /* Assigning into existing strings reuses their storage for recycled responses */
+  out.resize(waypoints.size());
+
+  for (std::size_t i = 0; i < waypoints.size(); ++i) {
+    const auto& waypoint_typed = waypoints[i].get<osrm::json::Object>();
+    const auto hint = waypoint_typed.values.find("hint");
+
+    if (hint != waypoint_typed.values.end())
+      out[i] = hint->second.get<osrm::json::String>().value;
+    else
+      out[i].clear();
+  }
+}
+
+static const char* osrmc_waypoint_hint(const std::vector<std::string>& hints, size_t index, osrmc_error_t* error) {
+  if (index >= hints.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Waypoint index out of range");
+    return nullptr;
+  }
+
+  return hints[index].c_str();
+}
+
+/* Marks responses handed out by an arena, which must not be destructed on their own.
+ * Copies, e.g. into or out of the caches, never carry the mark over. */
+
+struct osrmc_arena_mark final {
+  osrmc_arena_mark() = default;
+  osrmc_arena_mark(const osrmc_arena_mark&) {}
+  osrmc_arena_mark& operator=(const osrmc_arena_mark&) { return *this; }
+
+  bool owned = false;
+};
+
+/* Responses are flattened once into compact structs right after the service call.
+ * The json tree libosrm produces is short-lived and accessors never walk it by key. It is still built and freed by
+ * the engine on every call: the flatbuffers result overload libosrm offers from 5.25 on is not used, so the engine's
+ * allocation and serialization cost remains and only the wrapper-side lookups and copies go away. */
+
+struct osrmc_route_response final {
+  struct route final {
+    float distance;
+    float duration;
+
+    /* Interleaved longitude, latitude pairs */
+    std::vector<float> geometry;
+    bool has_geometry = false;
+
+    /* Annotations of all legs concatenated, flags tell which ones libosrm returned */
+    std::vector<float> durations;
+    std::vector<float> distances;
+    std::vector<float> speeds;
+    std::vector<unsigned long long> nodes;
+    unsigned annotations = 0;
+  };
+
+  std::vector<route> routes;
+  std::vector<std::string> waypoint_hints;
+
+  osrmc_arena_mark arena;
+
+  /* Empties the response for reuse, keeping the capacity of all buffers */
+  void recycle() {
+    for (auto& each : routes) {
+      each.geometry.clear();
+      each.has_geometry = false;
+      each.durations.clear();
+      each.distances.clear();
+      each.speeds.clear();
+      each.nodes.clear();
+      each.annotations = 0;
+    }
+  }
+};
+
+/* Google's encoded polyline format, latitude first; precision is 1e5 for polyline and 1e6 for polyline6 */
+static void osrmc_polyline_decode(const std::string& encoded, double precision, std::vector<float>& out) {
+  std::int64_t latitude = 0;
+  std::int64_t longitude = 0;
+  std::size_t i = 0;
+
+  const auto next = [&]() {
+    std::uint64_t result = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+
+    do {
+      if (i == encoded.size())
+        throw std::runtime_error{"Truncated polyline"};
+
+      byte = static_cast<unsigned char>(encoded[i++]) - 63;
+      result |= static_cast<std::uint64_t>(byte & 0x1f) << shift;
+      shift += 5;
+    } while (byte >= 0x20);
+
+    return (result & 1) ? ~static_cast<std::int64_t>(result >> 1) : static_cast<std::int64_t>(result >> 1);
+  };
+
+  out.reserve(encoded.size() / 4);
+
+  while (i < encoded.size()) {
+    latitude += next();
+    longitude += next();
+
+    out.push_back(static_cast<float>(longitude / precision));
+    out.push_back(static_cast<float>(latitude / precision));
+  }
+}
+
+static void osrmc_route_geometry_from_json(const osrm::json::Value& json, double precision, std::vector<float>& out) {
+  if (json.is<osrm::json::String>()) {
+    osrmc_polyline_decode(json.get<osrm::json::String>().value, precision, out);
+    return;
+  }
+
+  const auto& coordinates = json.get<osrm::json::Object>().values.at("coordinates").get<osrm::json::Array>().values;
+  out.reserve(coordinates.size() * 2);
+
+  for (const auto& coordinate : coordinates) {
+    const auto& location = coordinate.get<osrm::json::Array>().values;
+    out.push_back(static_cast<float>(location[0].get<osrm::json::Number>().value));
+    out.push_back(static_cast<float>(location[1].get<osrm::json::Number>().value));
+  }
+}
+
+template <typename T>
+static bool osrmc_route_annotation_from_json(const osrm::json::Object& annotation, const char* key,
+                                             std::vector<T>& out) {
+  const auto values = annotation.values.find(key);
+
+  if (values == annotation.values.end())
+    return false;
+
+  for (const auto& value : values->second.get<osrm::json::Array>().values)
+    out.push_back(static_cast<T>(value.get<osrm::json::Number>().value));
+
+  return true;
+}
+
+static void osrmc_route_annotations_from_json(const osrm::json::Value& json, osrmc_route_response::route& out) {
+  for (const auto& leg : json.get<osrm::json::Array>().values) {
+    const auto& leg_typed = leg.get<osrm::json::Object>();
+    const auto annotation = leg_typed.values.find("annotation");
+
+    if (annotation == leg_typed.values.end())
+      continue;
+
+    const auto& annotation_typed = annotation->second.get<osrm::json::Object>();
+
+    if (osrmc_route_annotation_from_json(annotation_typed, "duration", out.durations))
+      out.annotations |= OSRMC_ROUTE_ANNOTATIONS_DURATION;
+
+    if (osrmc_route_annotation_from_json(annotation_typed, "distance", out.distances))
+      out.annotations |= OSRMC_ROUTE_ANNOTATIONS_DISTANCE;
+
+    if (osrmc_route_annotation_from_json(annotation_typed, "speed", out.speeds))
+      out.annotations |= OSRMC_ROUTE_ANNOTATIONS_SPEED;
+
+    if (osrmc_route_annotation_from_json(annotation_typed, "nodes", out.nodes))
+      out.annotations |= OSRMC_ROUTE_ANNOTATIONS_NODES;
+  }
+}
+
+static void osrmc_route_response_from_json(const osrm::json::Object& json, const osrm::RouteParameters& params,
+                                           osrmc_route_response& out) {
+  const auto precision = params.geometries == osrm::RouteParameters::GeometriesType::Polyline6 ? 1e6 : 1e5;
+
+  const auto& routes = json.values.at("routes").get<osrm::json::Array>().values;
+  out.routes.resize(routes.size());
+
+  for (std::size_t i = 0; i < routes.size(); ++i) {
+    const auto& route_typed = routes[i].get<osrm::json::Object>();
+    auto& out_route = out.routes[i];
+
+    out_route.distance = static_cast<float>(route_typed.values.at("distance").get<osrm::json::Number>().value);
+    out_route.duration = static_cast<float>(route_typed.values.at("duration").get<osrm::json::Number>().value);
+
+    const auto geometry = route_typed.values.find("geometry");
+    if (geometry != route_typed.values.end()) {
+      osrmc_route_geometry_from_json(geometry->second, precision, out_route.geometry);
+      out_route.has_geometry = true;
+    }
+
+    const auto legs = route_typed.values.find("legs");
+    if (params.annotations && legs != route_typed.values.end())
+      osrmc_route_annotations_from_json(legs->second, out_route);
+  }
+
+  const auto waypoints = json.values.find("waypoints");
+  if (waypoints != json.values.end())
+    osrmc_waypoint_hints_from_json(waypoints->second, out.waypoint_hints);
+  else
+    out.waypoint_hints.clear();
+}
+
+static bool osrmc_route_run(osrmc_osrm_t osrm, const osrm::RouteParameters& params, osrmc_route_response& out,
+                            osrmc_error_t* error) {
+  const auto generation = osrmc_hints_generation(osrm);
+
+  osrm::RouteParameters hinted;
+  const auto& effective = osrmc_hints_apply(osrm, params, hinted);
+
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_ROUTE};
+
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Route(effective, result);
+
+  timer.engine_done();
+
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return false;
+  }
+
+  osrmc_route_response_from_json(result, effective, out);
+
+  timer.extraction_done();
+
+  if (out.waypoint_hints.size() == effective.coordinates.size())
+    for (std::size_t i = 0; i < out.waypoint_hints.size(); ++i)
+      osrmc_hints_store(osrm, effective, i, out.waypoint_hints[i], generation);
+
+  return true;
+}
+
+/* Flights are per dataset: a query picking up a reloaded engine never joins a flight computing on the previous one */
+static std::string osrmc_flight_key(osrmc_osrm_t osrm, const std::string& key) {
+  const auto generation = osrm->acquire()->generation;
+  return key + std::string(reinterpret_cast<const char*>(&generation), sizeof(generation));
+}
+
+static bool osrmc_route_query(osrmc_osrm_t osrm, const osrm::RouteParameters& params, osrmc_route_response& out,
+                              osrmc_error_t* error) {
+  if (!osrm->route_cache && !osrm->route_flights)
+    return osrmc_route_run(osrm, params, out, error);
+
+  const auto key = osrmc_fingerprint_of(params);
+
+  if (osrm->route_cache) {
+    if (const auto cached = osrm->route_cache->find(key)) {
+      out = *cached;
+      return true;
+    }
+  }
+
+  const auto compute = [&](osrmc_route_response& into, osrmc_error_t* into_error) {
+    /* Taken before the query picks its dataset: a reload clearing the cache in between voids the insert */
+    const auto generation = osrm->route_cache ? osrm->route_cache->generation() : 0;
+
+    if (!osrmc_route_run(osrm, params, into, into_error))
+      return false;
+
+    if (osrm->route_cache)
+      osrm->route_cache->insert(key, std::make_shared<const osrmc_route_response>(into), generation);
+
+    return true;
+  };
+
+  if (osrm->route_flights)
+    return osrm->route_flights->run(osrmc_flight_key(osrm, key), out, error, compute);
+
+  return compute(out, error);
+}
+
+osrmc_route_response_t osrmc_route(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  std::unique_ptr<osrmc_route_response> out{new osrmc_route_response};
+
+  if (!osrmc_route_query(osrm, *params_typed, *out, error))
+    return nullptr;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_route_batch(osrmc_osrm_t osrm, const osrmc_route_params_t* params, size_t n, osrmc_route_summary_t* results,
+                       osrmc_error_t* errors) {
+  osrmc_first_failure failure{errors};
+
+  osrm->pool->parallel_for(n, [&](std::size_t index) {
+    auto* error = errors ? &errors[index] : nullptr;
+
+    if (error)
+      *error = nullptr;
+
+    results[index].distance = INFINITY;
+    results[index].duration = INFINITY;
+
+    try {
+      auto* params_typed = reinterpret_cast<const osrm::RouteParameters*>(params[index]);
+
+      osrmc_route_response response;
+
+      if (!osrmc_route_query(osrm, *params_typed, response, error)) {
+        failure.record(osrmc_status_last, nullptr);
+        return;
+      }
+
+      if (response.routes.empty()) {
+        failure.record(osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Response contains no routes"), nullptr);
+        return;
+      }
+
+      results[index].distance = response.routes.front().distance;
+      results[index].duration = response.routes.front().duration;
+    } catch (const std::exception& e) {
+      failure.record(osrmc_error_from_exception(e, error), nullptr);
+    }
+  });
+
+  /* Per-query details are in errors, the calling thread's status tells whether any query failed */
+  failure.report(nullptr);
+}
+
+size_t osrmc_route_response_num_waypoints(osrmc_route_response_t response) { return response->waypoint_hints.size(); }
+
+const char* osrmc_route_response_waypoint_hint(osrmc_route_response_t response, size_t index, osrmc_error_t* error) {
+  return osrmc_waypoint_hint(response->waypoint_hints, index, error);
+}
+
+void osrmc_route_async(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_route_response_handler_t handler,
+                       void* data, osrmc_error_t* error) try {
+  osrm->pool->submit([=] {
+    osrmc_error_t response_error = nullptr;
+    auto* response = osrmc_route(osrm, params, &response_error);
+
+    handler(data, response, response_error);
+  });
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_async_queued(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_completion_queue_t queue,
+                              void* data, osrmc_error_t* error) try {
+  queue->retain();
+
+  try {
+    osrm->pool->submit([=] {
+      osrmc_error_t response_error = nullptr;
+      auto* response = osrmc_route(osrm, params, &response_error);
+
+      auto response_destruct = [](void* response) {
+        osrmc_route_response_destruct(static_cast<osrmc_route_response_t>(response));
+      };
+
+      queue->push({data, response, response_destruct, response_error});
+      queue->release();
+    });
+  } catch (...) {
+    queue->release();
+    throw;
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_with(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_waypoint_handler_t handler, void* data,
+                      osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  const auto generation = osrmc_hints_generation(osrm);
+
+  osrm::RouteParameters hinted;
+  const auto& effective = osrmc_hints_apply(osrm, *params_typed, hinted);
+
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_ROUTE};
+
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Route(effective, result);
+
+  timer.engine_done();
+
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return;
+  }
+
+  struct waypoint final {
+    const char* name;
+    float longitude;
+    float latitude;
+  };
+
+  /* Extracted up front so that the time spent in the handler is not accounted to extraction */
+  const auto& waypoints = result.values.at("waypoints").get<osrm::json::Array>().values;
+
+  std::vector<waypoint> extracted;
+  extracted.reserve(waypoints.size());
+
+  for (const auto& each : waypoints) {
+    const auto& waypoint_typed = each.get<osrm::json::Object>();
+    const auto& location = waypoint_typed.values.at("location").get<osrm::json::Array>().values;
+
+    const auto& name = waypoint_typed.values.at("name").get<osrm::json::String>().value;
+    const auto longitude = location[0].get<osrm::json::Number>().value;
+    const auto latitude = location[1].get<osrm::json::Number>().value;
+
+    extracted.push_back({name.c_str(), static_cast<float>(longitude), static_cast<float>(latitude)});
+  }
+
+  std::vector<std::string> hints;
+
+  if (osrm->hint_cache)
+    osrmc_waypoint_hints_from_json(result.values.at("waypoints"), hints);
+
+  timer.extraction_done();
+
+  if (hints.size() == effective.coordinates.size())
+    for (std::size_t i = 0; i < hints.size(); ++i)
+      osrmc_hints_store(osrm, effective, i, hints[i], generation);
+
+  for (const auto& each : extracted)
+    (void)handler(data, each.name, each.longitude, each.latitude);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_route_response_destruct(osrmc_route_response_t response) {
+  /* Arena responses are released by the arena's reset */
+  if (response && response->arena.owned)
+    return;
+
+  delete response;
+}
+
+float osrmc_route_response_distance(osrmc_route_response_t response, osrmc_error_t* error) {
+  if (response->routes.empty()) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Response contains no routes");
+    return INFINITY;
+  }
+
+  return response->routes.front().distance;
+}
+
+float osrmc_route_response_duration(osrmc_route_response_t response, osrmc_error_t* error) {
+  if (response->routes.empty()) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Response contains no routes");
+    return INFINITY;
+  }
+
+  return response->routes.front().duration;
+}
+
+size_t osrmc_route_response_num_routes(osrmc_route_response_t response) { return response->routes.size(); }
+
+static const osrmc_route_response::route* osrmc_route_response_route(osrmc_route_response_t response, size_t route,
+                                                                     osrmc_error_t* error) {
+  if (route >= response->routes.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Route index out of range");
+    return nullptr;
+  }
+
+  return &response->routes[route];
+}
+
+const float* osrmc_route_response_geometry(osrmc_route_response_t response, size_t route, size_t* num_coordinates,
+                                           osrmc_error_t* error) {
+  const auto* typed = osrmc_route_response_route(response, route, error);
+
+  if (!typed)
+    return nullptr;
+
+  if (!typed->has_geometry) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Route request not configured to return geometry");
+    return nullptr;
+  }
+
+  *num_coordinates = typed->geometry.size() / 2;
+  return typed->geometry.data();
+}
+
+template <typename T>
+static const T* osrmc_route_response_annotation(osrmc_route_response_t response, size_t route, unsigned annotation,
+                                                std::vector<T> osrmc_route_response::route::*values, size_t* length,
+                                                osrmc_error_t* error) {
+  const auto* typed = osrmc_route_response_route(response, route, error);
+
+  if (!typed)
+    return nullptr;
+
+  if (!(typed->annotations & annotation)) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Route request not configured to return this annotation");
+    return nullptr;
+  }
+
+  *length = (typed->*values).size();
+  return (typed->*values).data();
+}
+
+const float* osrmc_route_response_annotation_durations(osrmc_route_response_t response, size_t route, size_t* length,
+                                                       osrmc_error_t* error) {
+  return osrmc_route_response_annotation(response, route, OSRMC_ROUTE_ANNOTATIONS_DURATION,
+                                         &osrmc_route_response::route::durations, length, error);
+}
+
+const float* osrmc_route_response_annotation_distances(osrmc_route_response_t response, size_t route, size_t* length,
+                                                       osrmc_error_t* error) {
+  return osrmc_route_response_annotation(response, route, OSRMC_ROUTE_ANNOTATIONS_DISTANCE,
+                                         &osrmc_route_response::route::distances, length, error);
+}
+
+const float* osrmc_route_response_annotation_speeds(osrmc_route_response_t response, size_t route, size_t* length,
+                                                    osrmc_error_t* error) {
+  return osrmc_route_response_annotation(response, route, OSRMC_ROUTE_ANNOTATIONS_SPEED,
+                                         &osrmc_route_response::route::speeds, length, error);
+}
+
+const unsigned long long* osrmc_route_response_annotation_nodes(osrmc_route_response_t response, size_t route,
+                                                                size_t* length, osrmc_error_t* error) {
+  return osrmc_route_response_annotation(response, route, OSRMC_ROUTE_ANNOTATIONS_NODES,
+                                         &osrmc_route_response::route::nodes, length, error);
+}
+
+osrmc_table_annotations_t osrmc_table_annotations_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::TableParameters::AnnotationsType{osrm::TableParameters::AnnotationsType::Duration};
+  return reinterpret_cast<osrmc_table_annotations_t>(out);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_table_annotations_destruct(osrmc_table_annotations_t annotations) {
+  delete reinterpret_cast<osrm::TableParameters::AnnotationsType*>(annotations);
+}
+
+void osrmc_table_annotations_enable_distance(osrmc_table_annotations_t annotations, bool enable, osrmc_error_t* error) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+  auto* annotations_typed = reinterpret_cast<AnnotationsType*>(annotations);
+
+  if (enable) {
+    *annotations_typed |= AnnotationsType::Distance;
+  } else {
+    *annotations_typed = static_cast<AnnotationsType>(static_cast<int>(*annotations_typed) ^ static_cast<int>(AnnotationsType::Distance));
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+osrmc_table_params_t osrmc_table_params_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::TableParameters;
+  return reinterpret_cast<osrmc_table_params_t>(out);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_table_params_destruct(osrmc_table_params_t params) {
+  delete reinterpret_cast<osrm::TableParameters*>(params);
+}
+
+void osrmc_table_params_reset(osrmc_table_params_t params) {
+  osrmc_params_reset_typed(*reinterpret_cast<osrm::TableParameters*>(params));
+}
+
+osrmc_table_params_t osrmc_table_params_acquire(osrmc_error_t* error) try {
+  return reinterpret_cast<osrmc_table_params_t>(osrmc_params_pool<osrm::TableParameters>::acquire());
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_table_params_release(osrmc_table_params_t params) {
+  osrmc_params_pool<osrm::TableParameters>::release(reinterpret_cast<osrm::TableParameters*>(params));
+}
+
+void osrmc_table_params_add_source(osrmc_table_params_t params, size_t index, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+  params_typed->sources.emplace_back(index);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_params_add_destination(osrmc_table_params_t params, size_t index, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+  params_typed->destinations.emplace_back(index);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_params_add_sources(osrmc_table_params_t params, const size_t* indices, size_t n,
+                                    osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+  params_typed->sources.insert(params_typed->sources.end(), indices, indices + n);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_params_add_destinations(osrmc_table_params_t params, const size_t* indices, size_t n,
+                                         osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+  params_typed->destinations.insert(params_typed->destinations.end(), indices, indices + n);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_params_set_annotations(osrmc_table_params_t params, osrmc_table_annotations_t annotations, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+  auto* annotations_typed = reinterpret_cast<osrm::TableParameters::AnnotationsType*>(annotations);
+  params_typed->annotations = *annotations_typed;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+/* Unreachable cells are stored as INFINITY in the row-major matrices. */
+
+struct osrmc_table_response final {
+  std::size_t num_sources = 0;
+  std::size_t num_destinations = 0;
+
+  bool has_durations = false;
+  bool has_distances = false;
+
+  std::vector<float> durations;
+  std::vector<float> distances;
+
+  std::vector<std::string> source_hints;
+  std::vector<std::string> destination_hints;
+
+  osrmc_arena_mark arena;
+
+  /* Empties the response for reuse, keeping the capacity of all buffers */
+  void recycle() {
+    num_sources = 0;
+    num_destinations = 0;
+    has_durations = false;
+    has_distances = false;
+    durations.clear();
+    distances.clear();
+  }
+};
+
+static void osrmc_table_matrix_from_json(const osrm::json::Value& json, std::size_t& num_sources,
+                                         std::size_t& num_destinations, std::vector<float>& out) {
+  const auto& rows = json.get<osrm::json::Array>().values;
+
+  num_sources = rows.size();
+  num_destinations = rows.empty() ? 0 : rows.front().get<osrm::json::Array>().values.size();
+
+  out.reserve(num_sources * num_destinations);
+
+  for (const auto& row : rows) {
+    const auto& cells = row.get<osrm::json::Array>().values;
+
+    if (cells.size() != num_destinations)
+      throw std::runtime_error{"Table response rows differ in length"};
+
+    for (const auto& cell : cells) {
+      if (cell.is<osrm::json::Null>())
+        out.push_back(INFINITY);
+      else
+        out.push_back(cell.get<osrm::json::Number>().value);
+    }
+  }
+}
+
+static void osrmc_table_response_from_json(const osrm::json::Object& json, osrmc_table_response& out) {
+  const auto durations = json.values.find("durations");
+  if (durations != json.values.end()) {
+    osrmc_table_matrix_from_json(durations->second, out.num_sources, out.num_destinations, out.durations);
+    out.has_durations = true;
+  }
+
+  const auto distances = json.values.find("distances");
+  if (distances != json.values.end()) {
+    osrmc_table_matrix_from_json(distances->second, out.num_sources, out.num_destinations, out.distances);
+    out.has_distances = true;
+  }
+
+  const auto sources = json.values.find("sources");
+  if (sources != json.values.end())
+    osrmc_waypoint_hints_from_json(sources->second, out.source_hints);
+  else
+    out.source_hints.clear();
+
+  const auto destinations = json.values.find("destinations");
+  if (destinations != json.values.end())
+    osrmc_waypoint_hints_from_json(destinations->second, out.destination_hints);
+  else
+    out.destination_hints.clear();
+}
+
+static bool osrmc_table_run(osrmc_osrm_t osrm, const osrm::TableParameters& params, osrmc_table_response& out,
+                            osrmc_error_t* error) {
+  const auto generation = osrmc_hints_generation(osrm);
+
+  osrm::TableParameters hinted;
+  const auto& effective = osrmc_hints_apply(osrm, params, hinted);
+
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_TABLE};
+
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Table(effective, result);
+
+  timer.engine_done();
+
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return false;
+  }
+
+  osrmc_table_response_from_json(result, out);
+
+  timer.extraction_done();
+
+  if (osrm->hint_cache) {
+    for (std::size_t i = 0; i < out.source_hints.size(); ++i)
+      osrmc_hints_store(osrm, effective, effective.sources.empty() ? i : effective.sources[i], out.source_hints[i],
+                        generation);
+
+    for (std::size_t i = 0; i < out.destination_hints.size(); ++i)
+      osrmc_hints_store(osrm, effective, effective.destinations.empty() ? i : effective.destinations[i],
+                        out.destination_hints[i], generation);
+  }
+
+  return true;
+}
+
+static bool osrmc_table_query(osrmc_osrm_t osrm, const osrm::TableParameters& params, osrmc_table_response& out,
+                              osrmc_error_t* error) {
+  if (!osrm->table_cache && !osrm->table_flights)
+    return osrmc_table_run(osrm, params, out, error);
+
+  const auto key = osrmc_fingerprint_of(params);
+
+  if (osrm->table_cache) {
+    if (const auto cached = osrm->table_cache->find(key)) {
+      out = *cached;
+      return true;
+    }
+  }
+
+  const auto compute = [&](osrmc_table_response& into, osrmc_error_t* into_error) {
+    /* Taken before the query picks its dataset: a reload clearing the cache in between voids the insert */
+    const auto generation = osrm->table_cache ? osrm->table_cache->generation() : 0;
+
+    if (!osrmc_table_run(osrm, params, into, into_error))
+      return false;
+
+    if (osrm->table_cache)
+      osrm->table_cache->insert(key, std::make_shared<const osrmc_table_response>(into), generation);
+
+    return true;
+  };
+
+  if (osrm->table_flights)
+    return osrm->table_flights->run(osrmc_flight_key(osrm, key), out, error, compute);
+
+  return compute(out, error);
+}
+
+osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+
+  std::unique_ptr<osrmc_table_response> out{new osrmc_table_response};
+
+  if (!osrmc_table_query(osrm, *params_typed, *out, error))
+    return nullptr;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+/* Tiles only carry the coordinates they need: the tile's sources followed by the tile's destinations */
+
+static const std::size_t osrmc_table_default_tile_size = 256;
+
+static std::vector<std::size_t> osrmc_table_indices(const std::vector<std::size_t>& indices,
+                                                    std::size_t num_coordinates) {
+  if (!indices.empty())
+    return indices;
+
+  std::vector<std::size_t> all(num_coordinates);
+
+  for (std::size_t i = 0; i < num_coordinates; ++i)
+    all[i] = i;
+
+  return all;
+}
+
+static osrm::TableParameters osrmc_table_params_prototype(const osrm::TableParameters& params) {
+  auto prototype = params;
+
+  prototype.coordinates.clear();
+  prototype.hints.clear();
+  prototype.radiuses.clear();
+  prototype.bearings.clear();
+  prototype.approaches.clear();
+  prototype.sources.clear();
+  prototype.destinations.clear();
+
+  return prototype;
+}
+
+static bool osrmc_table_tiled_run(osrmc_osrm_t osrm, const osrm::TableParameters& params, std::size_t tile_size,
+                                  osrmc_table_response& out, osrmc_error_t* error) {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  if (tile_size == 0) {
+    const auto max_locations = osrm->acquire()->config.max_locations_distance_table;
+    tile_size = max_locations > 1 ? std::min<std::size_t>(max_locations / 2, osrmc_table_default_tile_size)
+                                  : osrmc_table_default_tile_size;
+  }
+
+  const auto sources = osrmc_table_indices(params.sources, params.coordinates.size());
+  const auto destinations = osrmc_table_indices(params.destinations, params.coordinates.size());
+
+  out.num_sources = sources.size();
+  out.num_destinations = destinations.size();
+  out.has_durations = static_cast<int>(params.annotations) & static_cast<int>(AnnotationsType::Duration);
+  out.has_distances = static_cast<int>(params.annotations) & static_cast<int>(AnnotationsType::Distance);
+
+  if (out.has_durations)
+    out.durations.assign(out.num_sources * out.num_destinations, INFINITY);
+
+  if (out.has_distances)
+    out.distances.assign(out.num_sources * out.num_destinations, INFINITY);
+
+  out.source_hints.resize(out.num_sources);
+  out.destination_hints.resize(out.num_destinations);
+
+  const auto source_tiles = (sources.size() + tile_size - 1) / tile_size;
+  const auto destination_tiles = (destinations.size() + tile_size - 1) / tile_size;
+
+  const auto prototype = osrmc_table_params_prototype(params);
+
+  osrmc_first_failure failure{error};
+
+  osrm->pool->parallel_for(source_tiles * destination_tiles, [&](std::size_t tile) {
+    const auto source_first = (tile / destination_tiles) * tile_size;
+    const auto source_last = std::min(source_first + tile_size, sources.size());
+    const auto destination_first = (tile % destination_tiles) * tile_size;
+    const auto destination_last = std::min(destination_first + tile_size, destinations.size());
+
+    osrmc_error_t tile_error = nullptr;
+
+    try {
+      auto tile_params = prototype;
+
+      for (auto i = source_first; i < source_last; ++i) {
+        tile_params.sources.push_back(tile_params.coordinates.size());
+        osrmc_params_copy_coordinate(params, sources[i], tile_params);
+      }
+
+      for (auto i = destination_first; i < destination_last; ++i) {
+        tile_params.destinations.push_back(tile_params.coordinates.size());
+        osrmc_params_copy_coordinate(params, destinations[i], tile_params);
+      }
+
+      osrmc_table_response tile_response;
+
+      if (!osrmc_table_run(osrm, tile_params, tile_response, failure.details_for(tile_error))) {
+        failure.record(osrmc_status_last, tile_error);
+        return;
+      }
+
+      const auto tile_destinations = destination_last - destination_first;
+
+      for (auto i = source_first; i < source_last; ++i) {
+        const auto from = (i - source_first) * tile_destinations;
+        const auto into = i * out.num_destinations + destination_first;
+
+        if (out.has_durations && tile_response.has_durations)
+          std::copy_n(tile_response.durations.begin() + from, tile_destinations, out.durations.begin() + into);
+
+        if (out.has_distances && tile_response.has_distances)
+          std::copy_n(tile_response.distances.begin() + from, tile_destinations, out.distances.begin() + into);
+      }
+
+      /* Hints are the same in every tile: take them from the first tile column and row only */
+      const auto tile_sources = source_last - source_first;
+
+      if (tile % destination_tiles == 0 && tile_response.source_hints.size() == tile_sources)
+        std::move(tile_response.source_hints.begin(), tile_response.source_hints.end(),
+                  out.source_hints.begin() + source_first);
+
+      if (tile / destination_tiles == 0 && tile_response.destination_hints.size() == tile_destinations)
+        std::move(tile_response.destination_hints.begin(), tile_response.destination_hints.end(),
+                  out.destination_hints.begin() + destination_first);
+    } catch (const std::exception& e) {
+      failure.record(osrmc_error_from_exception(e, failure.details_for(tile_error)), tile_error);
+    }
+  });
+
+  return !failure.report(error);
+}
+
+osrmc_table_response_t osrmc_table_tiled(osrmc_osrm_t osrm, osrmc_table_params_t params, size_t tile_size,
+                                         osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+
+  std::unique_ptr<osrmc_table_response> out{new osrmc_table_response};
+
+  if (!osrmc_table_tiled_run(osrm, *params_typed, tile_size, *out, error))
+    return nullptr;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+/* Origin-destination pairs are grouped by the side with fewer distinct coordinates, so pairs sharing an origin (or
+ * destination) end up in the same row (or column). Groups are packed into small tables of at most side_size keys and
+ * side_size others, but only while the table computes at most max_overhead times the cells asked for: groups without
+ * shared coordinates stay in tables of their own, down to a single row and column for a lone pair. */
+
+static const std::size_t osrmc_od_pairs_default_side_size = 64;
+static const std::size_t osrmc_od_pairs_max_overhead = 2;
+
+static std::uint64_t osrmc_od_pairs_coordinate_key(float longitude, float latitude) {
+  std::uint32_t longitude_bits, latitude_bits;
+  std::memcpy(&longitude_bits, &longitude, sizeof(longitude_bits));
+  std::memcpy(&latitude_bits, &latitude, sizeof(latitude_bits));
+
+  return static_cast<std::uint64_t>(longitude_bits) << 32 | latitude_bits;
+}
+
+/* Dense ids for distinct coordinates, ids[i] for every pair and the first pair using each id */
+static void osrmc_od_pairs_distinct(const float* longitudes, const float* latitudes, std::size_t k,
+                                    std::vector<std::size_t>& ids, std::vector<std::size_t>& firsts) {
+  std::unordered_map<std::uint64_t, std::size_t> seen;
+  seen.reserve(k);
+
+  ids.resize(k);
+
+  for (std::size_t i = 0; i < k; ++i) {
+    const auto inserted = seen.emplace(osrmc_od_pairs_coordinate_key(longitudes[i], latitudes[i]), firsts.size());
+
+    if (inserted.second)
+      firsts.push_back(i);
+
+    ids[i] = inserted.first->second;
+  }
+}
+
+void osrmc_od_pairs(osrmc_osrm_t osrm, const float* source_longitudes, const float* source_latitudes,
+                    const float* destination_longitudes, const float* destination_latitudes, size_t k,
+                    float* durations, float* distances, osrmc_error_t* error) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  if (durations)
+    std::fill_n(durations, k, INFINITY);
+
+  if (distances)
+    std::fill_n(distances, k, INFINITY);
+
+  /* Nothing asked for, nothing to query */
+  if (k == 0 || (!durations && !distances))
+    return;
+
+  std::vector<std::size_t> source_ids, source_firsts;
+  std::vector<std::size_t> destination_ids, destination_firsts;
+
+  osrmc_od_pairs_distinct(source_longitudes, source_latitudes, k, source_ids, source_firsts);
+  osrmc_od_pairs_distinct(destination_longitudes, destination_latitudes, k, destination_ids, destination_firsts);
+
+  /* Keys are the table rows or columns shared between pairs, others the opposite side */
+  const auto by_source = source_firsts.size() <= destination_firsts.size();
+
+  const auto& key_ids = by_source ? source_ids : destination_ids;
+  const auto& other_ids = by_source ? destination_ids : source_ids;
+  const auto num_keys = by_source ? source_firsts.size() : destination_firsts.size();
+
+  std::vector<std::vector<std::size_t>> groups(num_keys);
+
+  for (std::size_t i = 0; i < k; ++i)
+    groups[key_ids[i]].push_back(i);
+
+  const auto max_locations = osrm->acquire()->config.max_locations_distance_table;
+  const auto side_size = max_locations > 1
+                             ? std::min<std::size_t>(max_locations / 2, osrmc_od_pairs_default_side_size)
+                             : osrmc_od_pairs_default_side_size;
+
+  /* Each query is a list of pairs; a group larger than a side is split over several queries */
+  std::vector<std::vector<std::size_t>> queries;
+  std::size_t query_keys = 0;
+  std::unordered_set<std::size_t> query_others;
+
+  for (const auto& group : groups) {
+    for (std::size_t first = 0; first < group.size(); first += side_size) {
+      const auto last = std::min(first + side_size, group.size());
+
+      std::unordered_set<std::size_t> fresh;
+
+      for (auto i = first; i < last; ++i)
+        if (!query_others.count(other_ids[group[i]]))
+          fresh.insert(other_ids[group[i]]);
+
+      const auto others = query_others.size() + fresh.size();
+      const auto pairs = (queries.empty() ? 0 : queries.back().size()) + (last - first);
+
+      /* Computed cells are keys x others, asked for are the pairs */
+      if (queries.empty() || query_keys == side_size || others > side_size ||
+          (query_keys + 1) * others > osrmc_od_pairs_max_overhead * pairs) {
+        queries.emplace_back();
+        query_keys = 0;
+        query_others.clear();
+      }
+
+      for (auto i = first; i < last; ++i)
+        query_others.insert(other_ids[group[i]]);
+
+      queries.back().insert(queries.back().end(), group.begin() + first, group.begin() + last);
+      ++query_keys;
+    }
+  }
+
+  /* Only have the engine compute the annotations with an output buffer */
+  auto annotations = static_cast<int>(AnnotationsType::None);
+
+  if (durations)
+    annotations |= static_cast<int>(AnnotationsType::Duration);
+
+  if (distances)
+    annotations |= static_cast<int>(AnnotationsType::Distance);
+
+  osrmc_first_failure failure{error};
+
+  osrm->pool->parallel_for(queries.size(), [&](std::size_t query) {
+    const auto& pairs = queries[query];
+
+    osrmc_error_t query_error = nullptr;
+
+    try {
+      osrm::TableParameters params;
+      params.annotations = static_cast<AnnotationsType>(annotations);
+
+      /* Table rows and columns for each distinct coordinate in this query */
+      std::unordered_map<std::size_t, std::size_t> rows, columns;
+
+      const auto add = [&](std::unordered_map<std::size_t, std::size_t>& slots, std::vector<std::size_t>& indices,
+                           std::size_t id, float longitude, float latitude) {
+        const auto inserted = slots.emplace(id, indices.size());
+
+        if (inserted.second) {
+          indices.push_back(params.coordinates.size());
+          params.coordinates.emplace_back(osrm::util::FloatLongitude{longitude}, osrm::util::FloatLatitude{latitude});
+        }
+
+        return inserted.first->second;
+      };
+
+      std::vector<std::pair<std::size_t, std::size_t>> cells;
+      cells.reserve(pairs.size());
+
+      for (const auto i : pairs) {
+        const auto row = add(rows, params.sources, source_ids[i], source_longitudes[i], source_latitudes[i]);
+        const auto column = add(columns, params.destinations, destination_ids[i], destination_longitudes[i],
+                                destination_latitudes[i]);
+
+        cells.emplace_back(row, column);
+      }
+
+      osrmc_table_response response;
+
+      if (!osrmc_table_run(osrm, params, response, failure.details_for(query_error))) {
+        failure.record(osrmc_status_last, query_error);
+        return;
+      }
+
+      for (std::size_t j = 0; j < pairs.size(); ++j) {
+        const auto cell = cells[j].first * response.num_destinations + cells[j].second;
+
+        if (durations && response.has_durations)
+          durations[pairs[j]] = response.durations[cell];
+
+        if (distances && response.has_distances)
+          distances[pairs[j]] = response.distances[cell];
+      }
+    } catch (const std::exception& e) {
+      failure.record(osrmc_error_from_exception(e, failure.details_for(query_error)), query_error);
+    }
+  });
+
+  failure.report(error);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_response_destruct(osrmc_table_response_t response) {
+  /* Arena responses are released by the arena's reset */
+  if (response && response->arena.owned)
+    return;
+
+  delete response;
+}
+
+void osrmc_table_async(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_table_response_handler_t handler,
+                       void* data, osrmc_error_t* error) try {
+  osrm->pool->submit([=] {
+    osrmc_error_t response_error = nullptr;
+    auto* response = osrmc_table(osrm, params, &response_error);
+
+    handler(data, response, response_error);
+  });
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+void osrmc_table_async_queued(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_completion_queue_t queue,
+                              void* data, osrmc_error_t* error) try {
+  queue->retain();
+
+  try {
+    osrm->pool->submit([=] {
+      osrmc_error_t response_error = nullptr;
+      auto* response = osrmc_table(osrm, params, &response_error);
+
+      auto response_destruct = [](void* response) {
+        osrmc_table_response_destruct(static_cast<osrmc_table_response_t>(response));
+      };
+
+      queue->push({data, response, response_destruct, response_error});
+      queue->release();
+    });
+  } catch (...) {
+    queue->release();
+    throw;
+  }
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+static float osrmc_table_response_cell(const std::vector<float>& matrix, std::size_t num_sources,
+                                       std::size_t num_destinations, unsigned long from, unsigned long to,
+                                       osrmc_error_t* error) {
+  if (from >= num_sources || to >= num_destinations) {
+    osrmc_error_set(error, OSRMC_STATUS_EXCEPTION, "Table index out of range");
+    return INFINITY;
+  }
+
+  const auto value = matrix[from * num_destinations + to];
+
+  if (std::isinf(value)) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_ROUTE, "Impossible route between points");
+    return INFINITY;
+  }
+
+  return value;
+}
+
+float osrmc_table_response_duration(osrmc_table_response_t response, unsigned long from, unsigned long to,
+                                    osrmc_error_t* error) {
+  if (!response->has_durations) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return durations");
+    return INFINITY;
+  }
+
+  return osrmc_table_response_cell(response->durations, response->num_sources, response->num_destinations, from, to,
+                                   error);
+}
+
+float osrmc_table_response_distance(osrmc_table_response_t response, unsigned long from, unsigned long to,
+                                    osrmc_error_t* error) {
+  if (!response->has_distances) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return distances");
+    return INFINITY;
+  }
+
+  return osrmc_table_response_cell(response->distances, response->num_sources, response->num_destinations, from, to,
+                                   error);
+}
+
+const char* osrmc_table_response_source_hint(osrmc_table_response_t response, size_t index, osrmc_error_t* error) {
+  return osrmc_waypoint_hint(response->source_hints, index, error);
+}
+
+const char* osrmc_table_response_destination_hint(osrmc_table_response_t response, size_t index,
+                                                  osrmc_error_t* error) {
+  return osrmc_waypoint_hint(response->destination_hints, index, error);
+}
+
+size_t osrmc_table_response_num_sources(osrmc_table_response_t response, osrmc_error_t* error) {
+  if (!response->has_durations && !response->has_distances) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return durations or distances");
+    return 0;
+  }
+
+  return response->num_sources;
+}
+
+size_t osrmc_table_response_num_destinations(osrmc_table_response_t response, osrmc_error_t* error) {
+  if (!response->has_durations && !response->has_distances) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return durations or distances");
+    return 0;
+  }
+
+  return response->num_destinations;
+}
+
+static void osrmc_table_response_copy(const std::vector<float>& matrix, float* out, size_t size,
+                                      unsigned char* unreachable, osrmc_error_t* error) {
+  if (size < matrix.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_BUFFER, "Buffer too small for table of sources x destinations");
+    return;
+  }
+
+  std::copy(matrix.begin(), matrix.end(), out);
+
+  if (unreachable) {
+    std::memset(unreachable, 0, (size + 7) / 8);
+
+    for (std::size_t index = 0; index < matrix.size(); ++index)
+      if (std::isinf(matrix[index]))
+        unreachable[index / 8] |= static_cast<unsigned char>(1u << (index % 8));
+  }
+}
+
+void osrmc_table_response_durations_copy(osrmc_table_response_t response, float* durations, size_t size,
+                                         unsigned char* unreachable, osrmc_error_t* error) {
+  if (!response->has_durations) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return durations");
+    return;
+  }
+
+  osrmc_table_response_copy(response->durations, durations, size, unreachable, error);
+}
+
+void osrmc_table_response_distances_copy(osrmc_table_response_t response, float* distances, size_t size,
+                                         unsigned char* unreachable, osrmc_error_t* error) {
+  if (!response->has_distances) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Table request not configured to return distances");
+    return;
+  }
+
+  osrmc_table_response_copy(response->distances, distances, size, unreachable, error);
+}
+
+/* An arena is a pool of recycled response structs: they live in deques for stable addresses, the first used ones are
+ * handed out and reset only rewinds the counts. Only the flat responses are recycled; the json::Object libosrm builds
+ * for every query is allocated and freed by the engine as usual. */
+
+struct osrmc_arena final {
+  std::deque<osrmc_route_response> routes;
+  std::size_t routes_used = 0;
+
+  std::deque<osrmc_table_response> tables;
+  std::size_t tables_used = 0;
+};
+
+template <typename Response>
+static Response& osrmc_arena_next(std::deque<Response>& responses, std::size_t used) {
+  if (used == responses.size())
+    responses.emplace_back();
+
+  auto& out = responses[used];
+  out.recycle();
+  out.arena.owned = true;
+
+  return out;
+}
+
+osrmc_arena_t osrmc_arena_construct(osrmc_error_t* error) try {
+  return new osrmc_arena;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_arena_destruct(osrmc_arena_t arena) { delete arena; }
+
+void osrmc_arena_reset(osrmc_arena_t arena) {
+  arena->routes_used = 0;
+  arena->tables_used = 0;
+}
+
+osrmc_route_response_t osrmc_route_in(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_arena_t arena,
+                                      osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+
+  auto& out = osrmc_arena_next(arena->routes, arena->routes_used);
+
+  if (!osrmc_route_query(osrm, *params_typed, out, error))
+    return nullptr;
+
+  ++arena->routes_used;
+  return &out;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+osrmc_table_response_t osrmc_table_in(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_arena_t arena,
+                                      osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+
+  auto& out = osrmc_arena_next(arena->tables, arena->tables_used);
+
+  if (!osrmc_table_query(osrm, *params_typed, out, error))
+    return nullptr;
+
+  ++arena->tables_used;
+  return &out;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+/* Scheduled variants wait for a slot of the osrm handle's scheduler before running the query as usual */
+
+static bool osrmc_scheduler_check(osrmc_osrm_t osrm, osrmc_priority_t priority, osrmc_error_t* error) {
+  if (priority != OSRMC_PRIORITY_INTERACTIVE && priority != OSRMC_PRIORITY_BATCH) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown priority");
+    return false;
+  }
+
+  if (priority == OSRMC_PRIORITY_BATCH && osrm->scheduler && !osrm->scheduler->admits_batch()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Batch queries need a max concurrency of at least 2");
+    return false;
+  }
+
+  return true;
+}
+
+osrmc_route_response_t osrmc_route_scheduled(osrmc_osrm_t osrm, osrmc_route_params_t params,
+                                             osrmc_priority_t priority, unsigned timeout_ms,
+                                             osrmc_error_t* error) try {
+  if (!osrmc_scheduler_check(osrm, priority, error))
+    return nullptr;
+
+  osrmc_scheduler_slot slot{osrm->scheduler.get(), priority, timeout_ms};
+
+  if (slot.status != OSRMC_STATUS_OK) {
+    osrmc_stats_rejected(osrm->stats.get(), OSRMC_SERVICE_ROUTE, slot.status);
+    osrmc_error_set(error, slot.status, osrmc_status_messages[slot.status]);
+    return nullptr;
+  }
+
+  return osrmc_route(osrm, params, error);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+osrmc_table_response_t osrmc_table_scheduled(osrmc_osrm_t osrm, osrmc_table_params_t params,
+                                             osrmc_priority_t priority, unsigned timeout_ms,
+                                             osrmc_error_t* error) try {
+  if (!osrmc_scheduler_check(osrm, priority, error))
+    return nullptr;
+
+  osrmc_scheduler_slot slot{osrm->scheduler.get(), priority, timeout_ms};
+
+  if (slot.status != OSRMC_STATUS_OK) {
+    osrmc_stats_rejected(osrm->stats.get(), OSRMC_SERVICE_TABLE, slot.status);
+    osrmc_error_set(error, slot.status, osrmc_status_messages[slot.status]);
+    return nullptr;
+  }
+
+  return osrmc_table(osrm, params, error);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+/* Incrementally maintained square matrix over a growing and shrinking set of locations.
+ * Cells live in row-major buffers with a stride of capacity, so adding columns rarely needs a relayout. */
+
+struct osrmc_matrix final {
+  osrmc_osrm_t osrm;
+  osrm::TableParameters::AnnotationsType annotations;
+
+  std::vector<osrm::util::Coordinate> coordinates;
+  /* What each location snapped to, so later adds do not snap the existing locations again */
+  std::vector<boost::optional<osrm::engine::Hint>> hints;
+
+  std::size_t capacity = 0;
+  std::vector<float> durations;
+  std::vector<float> distances;
+
+  bool has_durations() const {
+    return static_cast<int>(annotations) & static_cast<int>(osrm::TableParameters::AnnotationsType::Duration);
+  }
+
+  bool has_distances() const {
+    return static_cast<int>(annotations) & static_cast<int>(osrm::TableParameters::AnnotationsType::Distance);
+  }
+
+  void reserve(std::size_t size) {
+    if (size <= capacity)
+      return;
+
+    const auto grown = std::max(size, capacity * 2);
+
+    const auto relayout = [&](const std::vector<float>& cells, std::vector<float>& next) {
+      next.assign(grown * grown, INFINITY);
+
+      for (std::size_t row = 0; row < coordinates.size(); ++row)
+        std::copy_n(cells.begin() + row * capacity, coordinates.size(), next.begin() + row * grown);
+    };
+
+    /* Both buffers are laid out before either is swapped in, so running out of memory leaves the matrix as is */
+    std::vector<float> next_durations;
+    std::vector<float> next_distances;
+
+    if (has_durations())
+      relayout(durations, next_durations);
+
+    if (has_distances())
+      relayout(distances, next_distances);
+
+    if (has_durations())
+      durations.swap(next_durations);
+
+    if (has_distances())
+      distances.swap(next_distances);
+
+    capacity = grown;
+  }
+};
+
+osrmc_matrix_t osrmc_matrix_construct(osrmc_osrm_t osrm, osrmc_table_annotations_t annotations,
+                                      osrmc_error_t* error) try {
+  using AnnotationsType = osrm::TableParameters::AnnotationsType;
+
+  std::unique_ptr<osrmc_matrix> out{new osrmc_matrix};
+  out->osrm = osrm;
+  out->annotations = annotations ? *reinterpret_cast<AnnotationsType*>(annotations) : AnnotationsType::Duration;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_matrix_destruct(osrmc_matrix_t matrix) { delete matrix; }
+
+size_t osrmc_matrix_size(osrmc_matrix_t matrix) { return matrix->coordinates.size(); }
+
+size_t osrmc_matrix_add_locations(osrmc_matrix_t matrix, const float* longitudes, const float* latitudes, size_t n,
+                                  osrmc_error_t* error) try {
+  const auto first = matrix->coordinates.size();
+  const auto size = first + n;
+
+  if (n == 0)
+    return first;
+
+  osrm::TableParameters params;
+  params.annotations = matrix->annotations;
+  params.generate_hints = true;
+  params.coordinates.reserve(size);
+  params.coordinates = matrix->coordinates;
+  params.hints.reserve(size);
+  params.hints = matrix->hints;
+
+  for (std::size_t i = 0; i < n; ++i)
+    params.coordinates.emplace_back(osrm::util::FloatLongitude{longitudes[i]}, osrm::util::FloatLatitude{latitudes[i]});
+
+  params.hints.resize(size);
+
+  /* New rows: new locations to all locations */
+  for (std::size_t i = first; i < size; ++i)
+    params.sources.push_back(i);
+
+  osrmc_table_response rows;
+
+  if (!osrmc_table_tiled_run(matrix->osrm, params, 0, rows, error))
+    return OSRMC_MATRIX_INVALID_INDEX;
+
+  /* The rows cover every location as a destination: fresh hints for the new ones and, after a reload, the old ones */
+  for (std::size_t i = 0; i < rows.destination_hints.size() && i < size; ++i)
+    if (!rows.destination_hints[i].empty())
+      params.hints[i] = osrm::engine::Hint::FromBase64(rows.destination_hints[i]);
+
+  /* New columns: old locations to new locations, the new x new block is already in the rows */
+  osrmc_table_response columns;
+
+  if (first > 0) {
+    params.sources.clear();
+
+    for (std::size_t i = 0; i < first; ++i)
+      params.sources.push_back(i);
+
+    for (std::size_t i = first; i < size; ++i)
+      params.destinations.push_back(i);
+
+    if (!osrmc_table_tiled_run(matrix->osrm, params, 0, columns, error))
+      return OSRMC_MATRIX_INVALID_INDEX;
+  }
+
+  matrix->reserve(size);
+  matrix->coordinates.swap(params.coordinates);
+  matrix->hints.swap(params.hints);
+
+  const auto stride = matrix->capacity;
+
+  const auto scatter = [&](std::vector<float>& cells, const std::vector<float>& new_rows,
+                           const std::vector<float>& new_columns) {
+    for (std::size_t row = 0; row < n; ++row)
+      std::copy_n(new_rows.begin() + row * size, size, cells.begin() + (first + row) * stride);
+
+    for (std::size_t row = 0; row < first; ++row)
+      std::copy_n(new_columns.begin() + row * n, n, cells.begin() + row * stride + first);
+  };
+
+  if (matrix->has_durations())
+    scatter(matrix->durations, rows.durations, columns.durations);
+
+  if (matrix->has_distances())
+    scatter(matrix->distances, rows.distances, columns.distances);
+
+  return first;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return OSRMC_MATRIX_INVALID_INDEX;
+}
+
+void osrmc_matrix_remove_location(osrmc_matrix_t matrix, size_t index, osrmc_error_t* error) try {
+  const auto size = matrix->coordinates.size();
+
+  if (index >= size) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Matrix index out of range");
+    return;
+  }
+
+  const auto last = size - 1;
+  const auto stride = matrix->capacity;
+
+  /* Swap-remove: the last location takes over row and column index */
+  const auto move_last = [&](std::vector<float>& cells) {
+    std::copy_n(cells.begin() + last * stride, size, cells.begin() + index * stride);
+
+    for (std::size_t row = 0; row < last; ++row)
+      cells[row * stride + index] = cells[row * stride + last];
+  };
+
+  if (index != last) {
+    if (matrix->has_durations())
+      move_last(matrix->durations);
+
+    if (matrix->has_distances())
+      move_last(matrix->distances);
+
+    matrix->coordinates[index] = matrix->coordinates[last];
+    matrix->hints[index] = matrix->hints[last];
+  }
+
+  matrix->coordinates.pop_back();
+  matrix->hints.pop_back();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+const float* osrmc_matrix_durations(osrmc_matrix_t matrix, size_t* stride, osrmc_error_t* error) {
+  if (!matrix->has_durations()) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Matrix not configured to hold durations");
+    return nullptr;
+  }
+
+  *stride = matrix->capacity;
+  return matrix->durations.data();
+}
+
+const float* osrmc_matrix_distances(osrmc_matrix_t matrix, size_t* stride, osrmc_error_t* error) {
+  if (!matrix->has_distances()) {
+    osrmc_error_set(error, OSRMC_STATUS_NO_TABLE, "Matrix not configured to hold distances");
+    return nullptr;
+  }
+
+  *stride = matrix->capacity;
+  return matrix->distances.data();
+}
+
+osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::NearestParameters;
+  return reinterpret_cast<osrmc_nearest_params_t>(out);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_nearest_params_destruct(osrmc_nearest_params_t params) {
+  delete reinterpret_cast<osrm::NearestParameters*>(params);
+}
+
+void osrmc_nearest_params_reset(osrmc_nearest_params_t params) {
+  osrmc_params_reset_typed(*reinterpret_cast<osrm::NearestParameters*>(params));
+}
+
+osrmc_nearest_params_t osrmc_nearest_params_acquire(osrmc_error_t* error) try {
+  return reinterpret_cast<osrmc_nearest_params_t>(osrmc_params_pool<osrm::NearestParameters>::acquire());
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_nearest_params_release(osrmc_nearest_params_t params) {
+  osrmc_params_pool<osrm::NearestParameters>::release(reinterpret_cast<osrm::NearestParameters*>(params));
+}
+
+osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::MatchParameters;
+  return reinterpret_cast<osrmc_match_params_t>(out);
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_match_params_destruct(osrmc_match_params_t params) {
+  delete reinterpret_cast<osrm::MatchParameters*>(params);
+}
+
+void osrmc_match_params_reset(osrmc_match_params_t params) {
+  osrmc_params_reset_typed(*reinterpret_cast<osrm::MatchParameters*>(params));
+}
+
+osrmc_match_params_t osrmc_match_params_acquire(osrmc_error_t* error) try {
+  return reinterpret_cast<osrmc_match_params_t>(osrmc_params_pool<osrm::MatchParameters>::acquire());
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_match_params_release(osrmc_match_params_t params) {
+  osrmc_params_pool<osrm::MatchParameters>::release(reinterpret_cast<osrm::MatchParameters*>(params));
+}
+
+void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
+  params_typed->number_of_results = n;
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+}
+
+struct osrmc_nearest_response final {
+  struct waypoint final {
+    float longitude;
+    float latitude;
+    float distance;
+    std::string name;
+    std::string hint;
+  };
+
+  std::vector<waypoint> waypoints;
+};
+
+static void osrmc_nearest_response_from_json(const osrm::json::Object& json, osrmc_nearest_response& out) {
+  const auto& waypoints = json.values.at("waypoints").get<osrm::json::Array>().values;
+  out.waypoints.reserve(waypoints.size());
+
+  for (const auto& waypoint : waypoints) {
+    const auto& waypoint_typed = waypoint.get<osrm::json::Object>();
+    const auto& location = waypoint_typed.values.at("location").get<osrm::json::Array>().values;
+
+    osrmc_nearest_response::waypoint out_waypoint;
+    out_waypoint.longitude = location.at(0).get<osrm::json::Number>().value;
+    out_waypoint.latitude = location.at(1).get<osrm::json::Number>().value;
+    out_waypoint.distance = waypoint_typed.values.at("distance").get<osrm::json::Number>().value;
+    out_waypoint.name = waypoint_typed.values.at("name").get<osrm::json::String>().value;
+
+    const auto hint = waypoint_typed.values.find("hint");
+    if (hint != waypoint_typed.values.end())
+      out_waypoint.hint = hint->second.get<osrm::json::String>().value;
+
+    out.waypoints.push_back(std::move(out_waypoint));
+  }
+}
+
+static bool osrmc_nearest_run(osrmc_osrm_t osrm, const osrm::NearestParameters& params, osrmc_nearest_response& out,
+                              osrmc_error_t* error) {
+  const auto generation = osrmc_hints_generation(osrm);
+
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_NEAREST};
+
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Nearest(params, result);
+
+  timer.engine_done();
+
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return false;
+  }
+
+  osrmc_nearest_response_from_json(result, out);
+
+  timer.extraction_done();
+
+  /* The first waypoint is the input coordinate's snapped location, the others are further candidates */
+  if (!out.waypoints.empty())
+    osrmc_hints_store(osrm, params, 0, out.waypoints.front().hint, generation);
+
+  return true;
+}
+
+osrmc_nearest_response_t osrmc_nearest(osrmc_osrm_t osrm, osrmc_nearest_params_t params, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
+
+  std::unique_ptr<osrmc_nearest_response> out{new osrmc_nearest_response};
+
+  if (!osrmc_nearest_run(osrm, *params_typed, *out, error))
+    return nullptr;
+
+  return out.release();
+} catch (const std::exception& e) {
+  osrmc_error_from_exception(e, error);
+  return nullptr;
+}
+
+void osrmc_nearest_response_destruct(osrmc_nearest_response_t response) { delete response; }
+
+size_t osrmc_nearest_response_count(osrmc_nearest_response_t response) { return response->waypoints.size(); }
+
+static const osrmc_nearest_response::waypoint* osrmc_nearest_response_waypoint(osrmc_nearest_response_t response,
+                                                                              size_t index, osrmc_error_t* error) {
+  if (index >= response->waypoints.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Waypoint index out of range");
+    return nullptr;
+  }
+
+  return &response->waypoints[index];
+}
+
+float osrmc_nearest_response_longitude(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error) {
+  const auto* waypoint = osrmc_nearest_response_waypoint(response, index, error);
+  return waypoint ? waypoint->longitude : NAN;
+}
+
+float osrmc_nearest_response_latitude(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error) {
+  const auto* waypoint = osrmc_nearest_response_waypoint(response, index, error);
+  return waypoint ? waypoint->latitude : NAN;
+}
+
+float osrmc_nearest_response_distance(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error) {
+  const auto* waypoint = osrmc_nearest_response_waypoint(response, index, error);
+  return waypoint ? waypoint->distance : INFINITY;
+}
+
+const char* osrmc_nearest_response_name(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error) {
+  const auto* waypoint = osrmc_nearest_response_waypoint(response, index, error);
+  return waypoint ? waypoint->name.c_str() : nullptr;
+}
+
+const char* osrmc_nearest_response_hint(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error) {
+  const auto* waypoint = osrmc_nearest_response_waypoint(response, index, error);
+  return waypoint ? waypoint->hint.c_str() : nullptr;
+}
+
+/* Batched snapping works on chunks, reusing one parameters object per chunk. libosrm's Nearest takes exactly one
+ * coordinate, so every point still is one engine call with its own json result; only the fields written to the caller's
+ * arrays are read from it. Hints are only generated if asked for and never go into the hint cache: bulk ingestion
+ * of raw pings would evict the hints Route and Table queries rely on. */
+
+static const std::size_t osrmc_nearest_batch_chunk_size = 256;
+
+size_t osrmc_nearest_batch(osrmc_osrm_t osrm, const float* longitudes, const float* latitudes, size_t n,
+                           float* snapped_longitudes, float* snapped_latitudes, float* distances, char* hints,
+                           size_t hint_stride, osrmc_status_t* statuses, osrmc_error_t* error) try {
+  const auto chunks = (n + osrmc_nearest_batch_chunk_size - 1) / osrmc_nearest_batch_chunk_size;
+
+  std::atomic<std::size_t> snapped{0};
+
+  osrmc_first_failure failure{error};
+
+  osrm->pool->parallel_for(chunks, [&](std::size_t chunk) {
+    const auto first = chunk * osrmc_nearest_batch_chunk_size;
+    const auto last = std::min(first + osrmc_nearest_batch_chunk_size, n);
+
+    std::size_t chunk_snapped = 0;
+
+    /* Points off the network are an expected outcome: they only show up in statuses, not in the thread's status */
+    const auto previous = osrmc_status_last;
+
+    try {
+      const auto engine = osrm->acquire();
+
+      osrm::NearestParameters params;
+      params.number_of_results = 1;
+      params.generate_hints = hints && hint_stride > 0;
+      params.coordinates.resize(1);
+
+      for (auto i = first; i < last; ++i) {
+        params.coordinates[0] = {osrm::util::FloatLongitude{longitudes[i]}, osrm::util::FloatLatitude{latitudes[i]}};
+
+        osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_NEAREST};
+
+        osrm::json::Object result;
+        const auto ok = engine->engine.Nearest(params, result) == osrm::Status::Ok;
+
+        timer.engine_done();
+
+        const osrm::json::Object* waypoint = nullptr;
+        auto status = OSRMC_STATUS_OK;
 
-unsigned osrmc_get_version(void) { return OSRMC_VERSION; }
+        if (ok) {
+          const auto& waypoints = result.values.at("waypoints").get<osrm::json::Array>().values;
 
-int osrmc_is_abi_compatible(void) { return osrmc_get_version() >> 16u == OSRMC_VERSION_MAJOR; }
+          if (!waypoints.empty())
+            waypoint = &waypoints.front().get<osrm::json::Object>();
+          else
+            status = OSRMC_STATUS_NO_SEGMENT;
+        } else {
+          status = osrmc_error_from_json(result, nullptr);
+          osrmc_status_last = previous;
+        }
 
-/* API */
+        if (waypoint) {
+          const auto& location = waypoint->values.at("location").get<osrm::json::Array>().values;
 
-struct osrmc_error final {
-  std::string code;
-  std::string message;
-};
+          if (snapped_longitudes)
+            snapped_longitudes[i] = location.at(0).get<osrm::json::Number>().value;
 
-static void osrmc_error_from_exception(const std::exception& e, osrmc_error_t* error) {
-  *error = new osrmc_error{"Exception", e.what()};
-}
+          if (snapped_latitudes)
+            snapped_latitudes[i] = location.at(1).get<osrm::json::Number>().value;
 
-static void osrmc_error_from_json(osrm::json::Object& json, osrmc_error_t* error) try {
-  auto code = json.values["code"].get<osrm::json::String>().value;
-  auto message = json.values["message"].get<osrm::json::String>().value;
-  if (code.empty()) {
-    code = "Unknown";
-  }
+          if (distances)
+            distances[i] = waypoint->values.at("distance").get<osrm::json::Number>().value;
+        } else {
+          if (snapped_longitudes)
+            snapped_longitudes[i] = NAN;
 
-  *error = new osrmc_error{code, message};
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-}
+          if (snapped_latitudes)
+            snapped_latitudes[i] = NAN;
 
-const char* osrmc_error_code(osrmc_error_t error) { return error->code.c_str(); }
+          if (distances)
+            distances[i] = INFINITY;
+        }
 
-const char* osrmc_error_message(osrmc_error_t error) { return error->message.c_str(); }
+        if (hints && hint_stride > 0) {
+          auto* hint = hints + i * hint_stride;
+          hint[0] = '\0';
 
-void osrmc_error_destruct(osrmc_error_t error) { delete error; }
+          if (waypoint) {
+            const auto found = waypoint->values.find("hint");
 
-osrmc_config_t osrmc_config_construct(const char* base_path, osrmc_error_t* error) try {
-  auto* out = new osrm::EngineConfig;
+            if (found != waypoint->values.end()) {
+              const auto& value = found->second.get<osrm::json::String>().value;
 
-  if (base_path)
-  {
-      out->storage_config = osrm::StorageConfig(base_path);
-      out->use_shared_memory = false;
-  }
-  else
-  {
-      out->use_shared_memory = true;
-  }
+              if (value.size() < hint_stride)
+                std::memcpy(hint, value.c_str(), value.size() + 1);
+            }
+          }
+        }
 
-  return reinterpret_cast<osrmc_config_t>(out);
+        if (statuses)
+          statuses[i] = status;
+
+        /* Empty waypoint lists count as failures too, so the stats agree with the statuses */
+        if (status == OSRMC_STATUS_OK)
+          timer.extraction_done();
+        else
+          timer.failed(status);
+
+        chunk_snapped += waypoint != nullptr;
+      }
+    } catch (const std::exception& e) {
+      osrmc_error_t chunk_error = nullptr;
+      failure.record(osrmc_error_from_exception(e, failure.details_for(chunk_error)), chunk_error);
+    }
+
+    snapped += chunk_snapped;
+  });
+
+  failure.report(error);
+
+  return snapped;
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return nullptr;
+  return 0;
 }
 
-void osrmc_config_destruct(osrmc_config_t config) { delete reinterpret_cast<osrm::EngineConfig*>(config); }
-
-osrmc_osrm_t osrmc_osrm_construct(osrmc_config_t config, osrmc_error_t* error) try {
-  auto* config_typed = reinterpret_cast<osrm::EngineConfig*>(config);
-  auto* out = new osrm::OSRM(*config_typed);
-
-  return reinterpret_cast<osrmc_osrm_t>(out);
+void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
+  params_typed->timestamps.emplace_back(timestamp);
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return nullptr;
 }
 
-void osrmc_osrm_destruct(osrmc_osrm_t osrm) { delete reinterpret_cast<osrm::OSRM*>(osrm); }
+struct osrmc_match_response final {
+  struct tracepoint final {
+    bool matched;
+    float longitude;
+    float latitude;
+    unsigned matchings_index;
+  };
 
-void osrmc_params_add_coordinate(osrmc_params_t params, float longitude, float latitude, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+  struct matching final {
+    float distance;
+    float duration;
+    float confidence;
+  };
 
-  auto longitude_typed = osrm::util::FloatLongitude{longitude};
-  auto latitude_typed = osrm::util::FloatLatitude{latitude};
+  std::vector<tracepoint> tracepoints;
+  std::vector<matching> matchings;
+};
 
-  params_typed->coordinates.emplace_back(std::move(longitude_typed), std::move(latitude_typed));
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
+static void osrmc_match_response_from_json(const osrm::json::Object& json, osrmc_match_response& out) {
+  const auto& tracepoints = json.values.at("tracepoints").get<osrm::json::Array>().values;
+  out.tracepoints.reserve(tracepoints.size());
+
+  for (const auto& tracepoint : tracepoints) {
+    if (tracepoint.is<osrm::json::Null>()) {
+      out.tracepoints.push_back({false, NAN, NAN, 0});
+      continue;
+    }
+
+    const auto& tracepoint_typed = tracepoint.get<osrm::json::Object>();
+    const auto& location = tracepoint_typed.values.at("location").get<osrm::json::Array>().values;
+
+    const auto longitude = location.at(0).get<osrm::json::Number>().value;
+    const auto latitude = location.at(1).get<osrm::json::Number>().value;
+    const auto matchings_index = tracepoint_typed.values.at("matchings_index").get<osrm::json::Number>().value;
+
+    out.tracepoints.push_back(
+        {true, static_cast<float>(longitude), static_cast<float>(latitude), static_cast<unsigned>(matchings_index)});
+  }
+
+  const auto& matchings = json.values.at("matchings").get<osrm::json::Array>().values;
+  out.matchings.reserve(matchings.size());
+
+  for (const auto& matching : matchings) {
+    const auto& matching_typed = matching.get<osrm::json::Object>();
+
+    const auto distance = matching_typed.values.at("distance").get<osrm::json::Number>().value;
+    const auto duration = matching_typed.values.at("duration").get<osrm::json::Number>().value;
+    const auto confidence = matching_typed.values.at("confidence").get<osrm::json::Number>().value;
+
+    out.matchings.push_back(
+        {static_cast<float>(distance), static_cast<float>(duration), static_cast<float>(confidence)});
+  }
 }
 
-void osrmc_params_add_coordinate_with(osrmc_params_t params, float longitude, float latitude, float radius, int bearing,
-                                      int range, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::engine::api::BaseParameters*>(params);
+static bool osrmc_match_run(osrmc_osrm_t osrm, const osrm::MatchParameters& params, osrmc_match_response& out,
+                            osrmc_error_t* error) {
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_MATCH};
 
-  auto longitude_typed = osrm::util::FloatLongitude{longitude};
-  auto latitude_typed = osrm::util::FloatLatitude{latitude};
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Match(params, result);
 
-  osrm::engine::Bearing bearing_typed{static_cast<short>(bearing), static_cast<short>(range)};
+  timer.engine_done();
 
-  params_typed->coordinates.emplace_back(std::move(longitude_typed), std::move(latitude_typed));
-  params_typed->radiuses.emplace_back(radius);
-  params_typed->bearings.emplace_back(std::move(bearing_typed));
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return false;
+  }
+
+  osrmc_match_response_from_json(result, out);
+
+  timer.extraction_done();
+  return true;
 }
 
-osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::RouteParameters;
+osrmc_match_response_t osrmc_match(osrmc_osrm_t osrm, osrmc_match_params_t params, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
 
-  return reinterpret_cast<osrmc_route_params_t>(out);
+  std::unique_ptr<osrmc_match_response> out{new osrmc_match_response};
+
+  if (!osrmc_match_run(osrm, *params_typed, *out, error))
+    return nullptr;
+
+  return out.release();
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_route_params_destruct(osrmc_route_params_t params) {
-  delete reinterpret_cast<osrm::RouteParameters*>(params);
+void osrmc_match_response_destruct(osrmc_match_response_t response) { delete response; }
+
+size_t osrmc_match_response_num_matchings(osrmc_match_response_t response) { return response->matchings.size(); }
+
+size_t osrmc_match_response_num_tracepoints(osrmc_match_response_t response) { return response->tracepoints.size(); }
+
+static const osrmc_match_response::matching* osrmc_match_response_matching(osrmc_match_response_t response,
+                                                                           size_t index, osrmc_error_t* error) {
+  if (index >= response->matchings.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Matching index out of range");
+    return nullptr;
+  }
+
+  return &response->matchings[index];
 }
 
-void osrmc_route_params_add_steps(osrmc_route_params_t params, int on) {
-  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
-  params_typed->steps = on;
+float osrmc_match_response_distance(osrmc_match_response_t response, size_t matching, osrmc_error_t* error) {
+  const auto* matching_typed = osrmc_match_response_matching(response, matching, error);
+  return matching_typed ? matching_typed->distance : INFINITY;
 }
 
-void osrmc_route_params_add_alternatives(osrmc_route_params_t params, int on) {
-  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
-  params_typed->alternatives = on;
+float osrmc_match_response_duration(osrmc_match_response_t response, size_t matching, osrmc_error_t* error) {
+  const auto* matching_typed = osrmc_match_response_matching(response, matching, error);
+  return matching_typed ? matching_typed->duration : INFINITY;
 }
 
-osrmc_route_response_t osrmc_route(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_error_t* error) try {
-  auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
-  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+float osrmc_match_response_confidence(osrmc_match_response_t response, size_t matching, osrmc_error_t* error) {
+  const auto* matching_typed = osrmc_match_response_matching(response, matching, error);
+  return matching_typed ? matching_typed->confidence : 0.f;
+}
 
-  auto* out = new osrm::json::Object;
-  const auto status = osrm_typed->Route(*params_typed, *out);
+bool osrmc_match_response_tracepoint(osrmc_match_response_t response, size_t index, float* longitude, float* latitude,
+                                     osrmc_error_t* error) {
+  if (index >= response->tracepoints.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Tracepoint index out of range");
+    return false;
+  }
 
-  if (status == osrm::Status::Ok)
-    return reinterpret_cast<osrmc_route_response_t>(out);
+  const auto& tracepoint = response->tracepoints[index];
 
-  osrmc_error_from_json(*out, error);
-  return nullptr;
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-  return nullptr;
+  *longitude = tracepoint.longitude;
+  *latitude = tracepoint.latitude;
+
+  return tracepoint.matched;
 }
 
-void osrmc_route_with(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_waypoint_handler_t handler, void* data,
-                      osrmc_error_t* error) try {
-  auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
-  auto* params_typed = reinterpret_cast<osrm::RouteParameters*>(params);
+/* Streaming matcher: buffers fixes and matches a bounded window at a time.
+ * Once the window is full all but the newest context fixes are finalized, their segments handed out, and the newest
+ * context finalized fixes kept at the front as history: the next window matches them again so segments leaving
+ * them are matched with their past. Each fix takes part in window / (window - 2 * context) matches. */
 
-  osrm::json::Object result;
-  const auto status = osrm_typed->Route(*params_typed, result);
+struct osrmc_matcher final {
+  struct fix final {
+    osrm::util::Coordinate coordinate;
+    unsigned timestamp;
+  };
 
-  if (status != osrm::Status::Ok) {
-    osrmc_error_from_json(result, error);
-    return;
+  struct segment final {
+    std::size_t from;
+    std::size_t to;
+    float duration;
+    float distance;
+    std::size_t geometry_first;
+    std::size_t geometry_size;
+  };
+
+  osrmc_osrm_t osrm;
+  std::size_t window;
+  std::size_t context;
+  bool with_geometry;
+
+  osrmc_matched_segment_handler_t handler;
+  void* data;
+
+  std::deque<fix> fixes;
+
+  /* Index of the front fix since construction, and how many fixes at the front are finalized history */
+  std::size_t first_index = 0;
+  std::size_t finalized = 0;
+
+  osrm::MatchParameters params;
+
+  /* Reused across windows: extracted segments, their concatenated geometries and per-matching bookkeeping */
+  std::vector<segment> segments;
+  std::vector<float> geometry;
+  std::vector<float> step_geometry;
+  std::vector<std::size_t> last_in_matching;
+
+  /* Segments of the window's legs ending in fixes [finalized, until), in order */
+  void extract(const osrm::json::Object& result, std::size_t until) {
+    const auto& tracepoints = result.values.at("tracepoints").get<osrm::json::Array>().values;
+    const auto& matchings = result.values.at("matchings").get<osrm::json::Array>().values;
+
+    const auto none = static_cast<std::size_t>(-1);
+    last_in_matching.assign(matchings.size(), none);
+
+    for (std::size_t p = 0; p < until && p < tracepoints.size(); ++p) {
+      if (tracepoints[p].is<osrm::json::Null>())
+        continue;
+
+      const auto& tracepoint = tracepoints[p].get<osrm::json::Object>();
+      const auto matching = static_cast<std::size_t>(
+          tracepoint.values.at("matchings_index").get<osrm::json::Number>().value);
+      const auto waypoint = static_cast<std::size_t>(
+          tracepoint.values.at("waypoint_index").get<osrm::json::Number>().value);
+
+      const auto previous = last_in_matching.at(matching);
+      last_in_matching[matching] = p;
+
+      /* Legs connect consecutive waypoints of a matching, leg waypoint - 1 ends in this fix */
+      if (p < finalized || previous == none || waypoint == 0)
+        continue;
+
+      const auto& matching_typed = matchings.at(matching).get<osrm::json::Object>();
+      const auto& legs = matching_typed.values.at("legs").get<osrm::json::Array>().values;
+      const auto& leg = legs.at(waypoint - 1).get<osrm::json::Object>();
+
+      segment out;
+      out.from = first_index + previous;
+      out.to = first_index + p;
+      out.duration = static_cast<float>(leg.values.at("duration").get<osrm::json::Number>().value);
+      out.distance = static_cast<float>(leg.values.at("distance").get<osrm::json::Number>().value);
+      out.geometry_first = geometry.size();
+
+      /* Steps join at shared coordinates, only keep one of them */
+      if (with_geometry) {
+        for (const auto& step : leg.values.at("steps").get<osrm::json::Array>().values) {
+          step_geometry.clear();
+          osrmc_route_geometry_from_json(step.get<osrm::json::Object>().values.at("geometry"), 1e6, step_geometry);
+
+          auto skip = std::size_t{0};
+
+          while (skip < step_geometry.size() && geometry.size() >= out.geometry_first + 2 &&
+                 step_geometry[skip] == geometry[geometry.size() - 2] &&
+                 step_geometry[skip + 1] == geometry[geometry.size() - 1])
+            skip += 2;
+
+          geometry.insert(geometry.end(), step_geometry.begin() + skip, step_geometry.end());
+        }
+      }
+
+      out.geometry_size = (geometry.size() - out.geometry_first) / 2;
+      segments.push_back(out);
+    }
   }
 
-  const auto& waypoints = result.values.at("waypoints").get<osrm::json::Array>().values;
+  /* Matches the buffered fixes and finalizes them up to position until */
+  void finalize(std::size_t until, osrmc_error_t* error) {
+    if (until <= finalized)
+      return;
 
-  for (const auto& waypoint : waypoints) {
-    const auto& waypoint_typed = waypoint.get<osrm::json::Object>();
-    const auto& location = waypoint_typed.values.at("location").get<osrm::json::Array>().values;
+    params.coordinates.clear();
+    params.timestamps.clear();
 
-    const auto& name = waypoint_typed.values.at("name").get<osrm::json::String>().value;
-    const auto longitude = location[0].get<osrm::json::Number>().value;
-    const auto latitude = location[1].get<osrm::json::Number>().value;
+    for (const auto& each : fixes) {
+      params.coordinates.push_back(each.coordinate);
+      params.timestamps.push_back(each.timestamp);
+    }
+
+    segments.clear();
+    geometry.clear();
+
+    if (fixes.size() > 1) {
+      osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_MATCH};
+
+      osrm::json::Object result;
+      const auto status = osrm->acquire()->engine.Match(params, result);
+
+      timer.engine_done();
+
+      if (status == osrm::Status::Ok) {
+        extract(result, until);
+        timer.extraction_done();
+      } else {
+        const auto previous = osrmc_status_last;
 
-    (void)handler(data, name.c_str(), longitude, latitude);
+        osrmc_error_t match_error = nullptr;
+        const auto code = osrmc_error_from_json(result, error ? &match_error : nullptr);
+
+        timer.failed(code);
+
+        /* Unmatchable windows are an expected outcome for noisy traces: their fixes get no segments */
+        if (code == OSRMC_STATUS_NO_MATCH || code == OSRMC_STATUS_NO_SEGMENT) {
+          osrmc_status_last = previous;
+          osrmc_error_destruct(match_error);
+        } else if (error) {
+          *error = match_error;
+        }
+      }
+    }
+
+    for (const auto& each : segments)
+      handler(data, each.from, each.to, each.duration, each.distance,
+              each.geometry_size > 0 ? geometry.data() + each.geometry_first : nullptr, each.geometry_size);
+
+    /* Keep the newest context finalized fixes as history for the next window */
+    const auto dropped = until - std::min(until, context);
+
+    fixes.erase(fixes.begin(), fixes.begin() + dropped);
+    first_index += dropped;
+    finalized = until - dropped;
   }
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-}
+};
 
-void osrmc_route_response_destruct(osrmc_route_response_t response) {
-  delete reinterpret_cast<osrm::json::Object*>(response);
-}
+osrmc_matcher_t osrmc_matcher_construct(osrmc_osrm_t osrm, size_t window, size_t context, bool geometry,
+                                        osrmc_matched_segment_handler_t handler, void* data,
+                                        osrmc_error_t* error) try {
+  if (window < 2 || 2 * context >= window) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE,
+                    "Matcher window has to be at least 2 and larger than twice its context");
+    return nullptr;
+  }
 
-float osrmc_route_response_distance(osrmc_route_response_t response, osrmc_error_t* error) try {
-  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+  std::unique_ptr<osrmc_matcher> out{new osrmc_matcher};
+  out->osrm = osrm;
+  out->window = window;
+  out->context = context;
+  out->with_geometry = geometry;
+  out->handler = handler;
+  out->data = data;
 
-  auto& routes = response_typed->values["routes"].get<osrm::json::Array>();
-  auto& route = routes.values.at(0).get<osrm::json::Object>();
+  /* Segment geometries come from the legs' steps; the overview geometry is not needed */
+  out->params.overview = osrm::RouteParameters::OverviewType::False;
+  out->params.geometries = osrm::RouteParameters::GeometriesType::Polyline6;
+  out->params.steps = geometry;
+  out->params.coordinates.reserve(window);
+  out->params.timestamps.reserve(window);
 
-  const auto distance = route.values["distance"].get<osrm::json::Number>().value;
-  return distance;
+  return out.release();
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return INFINITY;
+  return nullptr;
 }
 
-float osrmc_route_response_duration(osrmc_route_response_t response, osrmc_error_t* error) try {
-  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+void osrmc_matcher_destruct(osrmc_matcher_t matcher) { delete matcher; }
 
-  auto& routes = response_typed->values["routes"].get<osrm::json::Array>();
-  auto& route = routes.values.at(0).get<osrm::json::Object>();
+void osrmc_matcher_push(osrmc_matcher_t matcher, float longitude, float latitude, unsigned timestamp,
+                        osrmc_error_t* error) try {
+  matcher->fixes.push_back(
+      {osrm::util::Coordinate{osrm::util::FloatLongitude{longitude}, osrm::util::FloatLatitude{latitude}}, timestamp});
 
-  const auto duration = route.values["duration"].get<osrm::json::Number>().value;
-  return duration;
+  if (matcher->fixes.size() >= matcher->window)
+    matcher->finalize(matcher->fixes.size() - matcher->context, error);
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return INFINITY;
 }
 
-osrmc_table_annotations_t osrmc_table_annotations_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::TableParameters::AnnotationsType{osrm::TableParameters::AnnotationsType::Duration};
-  return reinterpret_cast<osrmc_table_annotations_t>(out);
+void osrmc_matcher_flush(osrmc_matcher_t matcher, osrmc_error_t* error) try {
+  matcher->finalize(matcher->fixes.size(), error);
+
+  /* The trace ends here: the next fix starts over without history */
+  matcher->first_index += matcher->fixes.size();
+  matcher->fixes.clear();
+  matcher->finalized = 0;
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
-  return nullptr;
-}
-
-void osrmc_table_annotations_destruct(osrmc_table_annotations_t annotations) {
-  delete reinterpret_cast<osrm::TableParameters::AnnotationsType*>(annotations);
 }
 
-void osrmc_table_annotations_enable_distance(osrmc_table_annotations_t annotations, bool enable, osrmc_error_t* error) try {
-  using AnnotationsType = osrm::TableParameters::AnnotationsType;
-  auto* annotations_typed = reinterpret_cast<AnnotationsType*>(annotations);
+/* Trip service */
 
-  if (enable) {
-    *annotations_typed |= AnnotationsType::Distance;
-  } else {
-    *annotations_typed = static_cast<AnnotationsType>(static_cast<int>(*annotations_typed) ^ static_cast<int>(AnnotationsType::Distance));
-  }
+osrmc_trip_params_t osrmc_trip_params_construct(osrmc_error_t* error) try {
+  auto* out = new osrm::TripParameters;
+  return reinterpret_cast<osrmc_trip_params_t>(out);
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
+  return nullptr;
 }
 
-osrmc_table_params_t osrmc_table_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::TableParameters;
-  return reinterpret_cast<osrmc_table_params_t>(out);
+void osrmc_trip_params_destruct(osrmc_trip_params_t params) { delete reinterpret_cast<osrm::TripParameters*>(params); }
+
+void osrmc_trip_params_reset(osrmc_trip_params_t params) {
+  osrmc_params_reset_typed(*reinterpret_cast<osrm::TripParameters*>(params));
+}
+
+osrmc_trip_params_t osrmc_trip_params_acquire(osrmc_error_t* error) try {
+  return reinterpret_cast<osrmc_trip_params_t>(osrmc_params_pool<osrm::TripParameters>::acquire());
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_table_params_destruct(osrmc_table_params_t params) {
-  delete reinterpret_cast<osrm::TableParameters*>(params);
+void osrmc_trip_params_release(osrmc_trip_params_t params) {
+  osrmc_params_pool<osrm::TripParameters>::release(reinterpret_cast<osrm::TripParameters*>(params));
 }
 
-void osrmc_table_params_add_source(osrmc_table_params_t params, size_t index, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
-  params_typed->sources.emplace_back(index);
+void osrmc_trip_params_set_roundtrip(osrmc_trip_params_t params, bool on, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TripParameters*>(params);
+  params_typed->roundtrip = on;
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
 }
 
-void osrmc_table_params_add_destination(osrmc_table_params_t params, size_t index, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
-  params_typed->destinations.emplace_back(index);
+void osrmc_trip_params_set_source(osrmc_trip_params_t params, osrmc_trip_source_t source, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TripParameters*>(params);
+
+  switch (source) {
+  case OSRMC_TRIP_SOURCE_ANY:
+    params_typed->source = osrm::TripParameters::SourceType::Any;
+    break;
+  case OSRMC_TRIP_SOURCE_FIRST:
+    params_typed->source = osrm::TripParameters::SourceType::First;
+    break;
+  default:
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown trip source");
+  }
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
 }
 
-void osrmc_table_params_set_annotations(osrmc_table_params_t params, osrmc_table_annotations_t annotations, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
-  auto* annotations_typed = reinterpret_cast<osrm::TableParameters::AnnotationsType*>(annotations);
-  params_typed->annotations = *annotations_typed;
+void osrmc_trip_params_set_destination(osrmc_trip_params_t params, osrmc_trip_destination_t destination,
+                                       osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TripParameters*>(params);
+
+  switch (destination) {
+  case OSRMC_TRIP_DESTINATION_ANY:
+    params_typed->destination = osrm::TripParameters::DestinationType::Any;
+    break;
+  case OSRMC_TRIP_DESTINATION_LAST:
+    params_typed->destination = osrm::TripParameters::DestinationType::Last;
+    break;
+  default:
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Unknown trip destination");
+  }
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
 }
 
-osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_error_t* error) try {
-  auto* osrm_typed = reinterpret_cast<osrm::OSRM*>(osrm);
-  auto* params_typed = reinterpret_cast<osrm::TableParameters*>(params);
+struct osrmc_trip_response final {
+  struct trip final {
+    float distance;
+    float duration;
+
+    /* Input coordinate indices in visiting order */
+    std::vector<size_t> order;
+    std::vector<float> leg_durations;
+    std::vector<float> leg_distances;
+  };
 
-  auto* out = new osrm::json::Object;
-  const auto status = osrm_typed->Table(*params_typed, *out);
+  std::vector<trip> trips;
+};
 
-  if (status == osrm::Status::Ok)
-    return reinterpret_cast<osrmc_table_response_t>(out);
+static void osrmc_trip_response_from_json(const osrm::json::Object& json, osrmc_trip_response& out) {
+  const auto& trips = json.values.at("trips").get<osrm::json::Array>().values;
+  out.trips.resize(trips.size());
 
-  osrmc_error_from_json(*out, error);
-  return nullptr;
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-  return nullptr;
-}
+  for (std::size_t i = 0; i < trips.size(); ++i) {
+    const auto& trip_typed = trips[i].get<osrm::json::Object>();
+    auto& out_trip = out.trips[i];
 
-void osrmc_table_response_destruct(osrmc_table_response_t response) {
-  delete reinterpret_cast<osrm::json::Object*>(response);
-}
+    out_trip.distance = static_cast<float>(trip_typed.values.at("distance").get<osrm::json::Number>().value);
+    out_trip.duration = static_cast<float>(trip_typed.values.at("duration").get<osrm::json::Number>().value);
 
-float osrmc_table_response_duration(osrmc_table_response_t response, unsigned long from, unsigned long to,
-                                    osrmc_error_t* error) try {
-  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+    const auto& legs = trip_typed.values.at("legs").get<osrm::json::Array>().values;
+    out_trip.leg_durations.reserve(legs.size());
+    out_trip.leg_distances.reserve(legs.size());
 
-  if (response_typed->values.find("durations") == response_typed->values.end()) {
-    *error = new osrmc_error{"NoTable", "Table request not configured to return durations"};
-    return INFINITY;
+    for (const auto& leg : legs) {
+      const auto& leg_typed = leg.get<osrm::json::Object>();
+      out_trip.leg_durations.push_back(
+          static_cast<float>(leg_typed.values.at("duration").get<osrm::json::Number>().value));
+      out_trip.leg_distances.push_back(
+          static_cast<float>(leg_typed.values.at("distance").get<osrm::json::Number>().value));
+    }
   }
 
-  auto& durations = response_typed->values["durations"].get<osrm::json::Array>();
-  auto& durations_from_to_all = durations.values.at(from).get<osrm::json::Array>();
-  auto nullable = durations_from_to_all.values.at(to);
+  /* Waypoints are in input order and know their trip and position within it: invert into visiting orders */
+  const auto& waypoints = json.values.at("waypoints").get<osrm::json::Array>().values;
 
-  if (nullable.is<osrm::json::Null>()) {
-    *error = new osrmc_error{"NoRoute", "Impossible route between points"};
-    return INFINITY;
+  std::vector<std::pair<std::size_t, std::size_t>> positions;
+  positions.reserve(waypoints.size());
+
+  for (const auto& waypoint : waypoints) {
+    const auto& waypoint_typed = waypoint.get<osrm::json::Object>();
+
+    const auto trip = waypoint_typed.values.at("trips_index").get<osrm::json::Number>().value;
+    const auto position = waypoint_typed.values.at("waypoint_index").get<osrm::json::Number>().value;
+
+    positions.emplace_back(static_cast<std::size_t>(trip), static_cast<std::size_t>(position));
+
+    auto& order = out.trips.at(positions.back().first).order;
+    order.resize(std::max(order.size(), positions.back().second + 1));
   }
-  auto duration = nullable.get<osrm::json::Number>().value;
 
-  return duration;
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-  return INFINITY;
+  for (std::size_t i = 0; i < positions.size(); ++i)
+    out.trips[positions[i].first].order[positions[i].second] = i;
 }
 
-float osrmc_table_response_distance(osrmc_table_response_t response, unsigned long from, unsigned long to,
-                                    osrmc_error_t* error) try {
-  auto* response_typed = reinterpret_cast<osrm::json::Object*>(response);
+static bool osrmc_trip_run(osrmc_osrm_t osrm, const osrm::TripParameters& params, osrmc_trip_response& out,
+                           osrmc_error_t* error) {
+  osrmc_stats_timer timer{osrm->stats.get(), OSRMC_SERVICE_TRIP};
 
-  if (response_typed->values.find("distances") == response_typed->values.end()) {
-    *error = new osrmc_error{"NoTable", "Table request not configured to return distances"};
-    return INFINITY;
-  }
+  osrm::json::Object result;
+  const auto status = osrm->acquire()->engine.Trip(params, result);
 
-  auto& distances = response_typed->values["distances"].get<osrm::json::Array>();
-  auto& distances_from_to_all = distances.values.at(from).get<osrm::json::Array>();
-  auto nullable = distances_from_to_all.values.at(to);
+  timer.engine_done();
 
-  if (nullable.is<osrm::json::Null>()) {
-    *error = new osrmc_error{"NoRoute", "Impossible route between points"};
-    return INFINITY;
+  if (status != osrm::Status::Ok) {
+    timer.failed(osrmc_error_from_json(result, error));
+    return false;
   }
-  auto distance = nullable.get<osrm::json::Number>().value;
 
-  return distance;
-} catch (const std::exception& e) {
-  *error = new osrmc_error{e.what()};
-  return INFINITY;
+  osrmc_trip_response_from_json(result, out);
+
+  timer.extraction_done();
+  return true;
 }
 
-osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::NearestParameters;
-  return reinterpret_cast<osrmc_nearest_params_t>(out);
+osrmc_trip_response_t osrmc_trip(osrmc_osrm_t osrm, osrmc_trip_params_t params, osrmc_error_t* error) try {
+  auto* params_typed = reinterpret_cast<osrm::TripParameters*>(params);
+
+  std::unique_ptr<osrmc_trip_response> out{new osrmc_trip_response};
+
+  if (!osrmc_trip_run(osrm, *params_typed, *out, error))
+    return nullptr;
+
+  return out.release();
 } catch (const std::exception& e) {
   osrmc_error_from_exception(e, error);
   return nullptr;
 }
 
-void osrmc_nearest_params_destruct(osrmc_nearest_params_t params) {
-  delete reinterpret_cast<osrm::NearestParameters*>(params);
+void osrmc_trip_response_destruct(osrmc_trip_response_t response) { delete response; }
+
+size_t osrmc_trip_response_num_trips(osrmc_trip_response_t response) { return response->trips.size(); }
+
+static const osrmc_trip_response::trip* osrmc_trip_response_trip(osrmc_trip_response_t response, size_t index,
+                                                                 osrmc_error_t* error) {
+  if (index >= response->trips.size()) {
+    osrmc_error_set(error, OSRMC_STATUS_INVALID_VALUE, "Trip index out of range");
+    return nullptr;
+  }
+
+  return &response->trips[index];
 }
 
-osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error) try {
-  auto* out = new osrm::MatchParameters;
-  return reinterpret_cast<osrmc_match_params_t>(out);
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
-  return nullptr;
+float osrmc_trip_response_distance(osrmc_trip_response_t response, size_t trip, osrmc_error_t* error) {
+  const auto* trip_typed = osrmc_trip_response_trip(response, trip, error);
+  return trip_typed ? trip_typed->distance : INFINITY;
 }
 
-void osrmc_match_params_destruct(osrmc_match_params_t params) {
-  delete reinterpret_cast<osrm::MatchParameters*>(params);
+float osrmc_trip_response_duration(osrmc_trip_response_t response, size_t trip, osrmc_error_t* error) {
+  const auto* trip_typed = osrmc_trip_response_trip(response, trip, error);
+  return trip_typed ? trip_typed->duration : INFINITY;
 }
 
-void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n) {
-  auto* params_typed = reinterpret_cast<osrm::NearestParameters*>(params);
-  params_typed->number_of_results = n;
+const size_t* osrmc_trip_response_order(osrmc_trip_response_t response, size_t trip, size_t* length,
+                                        osrmc_error_t* error) {
+  const auto* trip_typed = osrmc_trip_response_trip(response, trip, error);
+
+  if (!trip_typed)
+    return nullptr;
+
+  *length = trip_typed->order.size();
+  return trip_typed->order.data();
 }
 
-void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error) try {
-  auto* params_typed = reinterpret_cast<osrm::MatchParameters*>(params);
-  params_typed->timestamps.emplace_back(timestamp);
-} catch (const std::exception& e) {
-  osrmc_error_from_exception(e, error);
+const float* osrmc_trip_response_leg_durations(osrmc_trip_response_t response, size_t trip, size_t* length,
+                                               osrmc_error_t* error) {
+  const auto* trip_typed = osrmc_trip_response_trip(response, trip, error);
+
+  if (!trip_typed)
+    return nullptr;
+
+  *length = trip_typed->leg_durations.size();
+  return trip_typed->leg_durations.data();
+}
+
+const float* osrmc_trip_response_leg_distances(osrmc_trip_response_t response, size_t trip, size_t* length,
+                                               osrmc_error_t* error) {
+  const auto* trip_typed = osrmc_trip_response_trip(response, trip, error);
+
+  if (!trip_typed)
+    return nullptr;
+
+  *length = trip_typed->leg_distances.size();
+  return trip_typed->leg_distances.data();
 }
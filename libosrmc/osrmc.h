@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifndef OSRMC_H_
 #define OSRMC_H_
@@ -42,6 +43,11 @@
  *   osrmc_route_params_t params = osrmc_route_params_construct(&error);
  *   osrmc_route_params_add_alternatives(params, 1);
  *
+ * Parameters objects can be reused across queries: osrmc_service_params_reset restores the defaults
+ * while keeping the capacity of coordinates, radiuses, bearings, hints, sources and destinations.
+ * For hot loops osrmc_service_params_acquire hands out reset objects from a per-thread pool, and
+ * osrmc_service_params_release returns them to the pool of the releasing thread instead of destructing them.
+ *
  * Finally, you query the service passing the parameters object and extract specific results from it.
  *
  * Example:
@@ -80,6 +86,19 @@
  *     return EXIT_FAILURE;
  *   }
  *
+ * Alternatively pass NULL instead of an osrmc_error_t out parameter: failures then never allocate.
+ * Only on failure: the library stores a numeric osrmc_status_t for the calling thread, read it via osrmc_last_status.
+ * This suits hot paths where failures are expected, such as reading tables with many unreachable pairs.
+ *
+ * Example:
+ *
+ *   osrmc_clear_status();
+ *   for (from = 0; from < n; ++from)
+ *     for (to = 0; to < n; ++to)
+ *       durations[from * n + to] = osrmc_table_response_duration(response, from, to, NULL);
+ *   if (osrmc_last_status() != OSRMC_STATUS_OK)
+ *     fprintf(stderr, "Some pairs: %s\n", osrmc_status_message(osrmc_last_status()));
+ *
  *
  * Responses and Callbacks
  * =======================
@@ -89,6 +108,8 @@
  * Response object types follow the osrmc_service_response_t naming convention.
  * You take over ownership and have to destruct the response object via osrmc_service_response_destruct.
  * The library provides functions for extracting data from the response objects.
+ * Responses are compact structs read without lookups; the engine still builds its JSON result for every query and the
+ * library converts it once, so the engine's own per-query allocations remain.
  *
  * Example:
  *
@@ -108,6 +129,39 @@
  *
  *   osrmc_route_with(osrm, params, my_waypoint_handler, NULL, &error);
  *
+ *
+ * Asynchronous Queries
+ * ====================
+ *
+ * Route and Table queries can be submitted without blocking the calling thread.
+ * The query runs on the osrmc_osrm_t's worker pool; the parameters object has to stay alive until it completed.
+ * Pending queries are finished before osrmc_osrm_destruct returns.
+ *
+ * Either pass a handler which gets invoked on a worker thread with the response or the error.
+ * You take over ownership of both and have to destruct them as usual.
+ *
+ * Example:
+ *
+ *   void my_route_handler(void* data, osrmc_route_response_t response, osrmc_error_t error) {
+ *     if (error) { ...; osrmc_error_destruct(error); return; }
+ *     ...
+ *     osrmc_route_response_destruct(response);
+ *   }
+ *
+ *   osrmc_route_async(osrm, params, my_route_handler, NULL, &error);
+ *
+ * Or post completions to a completion queue and collect them from your own event loop.
+ * The queue's file descriptor is readable as long as completions are pending.
+ *
+ * Example:
+ *
+ *   queue = osrmc_completion_queue_construct(&error);
+ *   osrmc_route_async_queued(osrm, params, queue, my_tag, &error);
+ *
+ *   poll on osrmc_completion_queue_fd(queue), then:
+ *
+ *   while (osrmc_completion_queue_pop(queue, &tag, &response, &response_error)) { ... }
+ *
  */
 
 #ifdef __cplusplus
@@ -123,7 +177,7 @@ extern "C" {
 #endif
 
 #define OSRMC_VERSION_MAJOR 5
-#define OSRMC_VERSION_MINOR 3
+#define OSRMC_VERSION_MINOR 4
 #define OSRMC_VERSION ((OSRMC_VERSION_MAJOR << 16) | OSRMC_VERSION_MINOR)
 
 OSRMC_API unsigned osrmc_get_version(void);
@@ -133,10 +187,46 @@ OSRMC_API int osrmc_is_abi_compatible(void);
 
 typedef struct osrmc_error* osrmc_error_t;
 
+typedef enum osrmc_status {
+  OSRMC_STATUS_OK = 0,
+  OSRMC_STATUS_INVALID_URL = 1,
+  OSRMC_STATUS_INVALID_SERVICE = 2,
+  OSRMC_STATUS_INVALID_VERSION = 3,
+  OSRMC_STATUS_INVALID_OPTIONS = 4,
+  OSRMC_STATUS_INVALID_QUERY = 5,
+  OSRMC_STATUS_INVALID_VALUE = 6,
+  OSRMC_STATUS_NO_SEGMENT = 7,
+  OSRMC_STATUS_TOO_BIG = 8,
+  OSRMC_STATUS_NO_ROUTE = 9,
+  OSRMC_STATUS_NO_TABLE = 10,
+  OSRMC_STATUS_NO_MATCH = 11,
+  OSRMC_STATUS_NO_TRIPS = 12,
+  OSRMC_STATUS_NOT_IMPLEMENTED = 13,
+  OSRMC_STATUS_INVALID_BUFFER = 14,
+  OSRMC_STATUS_EXCEPTION = 15,
+  OSRMC_STATUS_UNKNOWN = 16,
+  OSRMC_STATUS_TIMEOUT = 17,
+  OSRMC_STATUS_OVERLOADED = 18
+} osrmc_status_t;
+
 /* Config and osrmc */
 
 typedef struct osrmc_config* osrmc_config_t;
+
+typedef enum osrmc_algorithm { OSRMC_ALGORITHM_CH = 0, OSRMC_ALGORITHM_MLD = 1 } osrmc_algorithm_t;
 typedef struct osrmc_osrm* osrmc_osrm_t;
+typedef struct osrmc_profiles* osrmc_profiles_t;
+
+/* Stats */
+
+typedef enum osrmc_service {
+  OSRMC_SERVICE_ROUTE = 0,
+  OSRMC_SERVICE_TABLE = 1,
+  OSRMC_SERVICE_NEAREST = 2,
+  OSRMC_SERVICE_MATCH = 3,
+  OSRMC_SERVICE_TRIP = 4
+} osrmc_service_t;
+typedef struct osrmc_stats* osrmc_stats_t;
 
 /* Generic parameters */
 
@@ -145,19 +235,77 @@ typedef struct osrmc_params* osrmc_params_t;
 /* Service-specific parameters */
 
 typedef struct osrmc_route_params* osrmc_route_params_t;
+
+typedef enum osrmc_overview {
+  OSRMC_OVERVIEW_SIMPLIFIED = 0,
+  OSRMC_OVERVIEW_FULL = 1,
+  OSRMC_OVERVIEW_FALSE = 2
+} osrmc_overview_t;
+
+typedef enum osrmc_geometries {
+  OSRMC_GEOMETRIES_POLYLINE = 0,
+  OSRMC_GEOMETRIES_POLYLINE6 = 1,
+  OSRMC_GEOMETRIES_GEOJSON = 2
+} osrmc_geometries_t;
+
+/* Flags, combine with | */
+typedef enum osrmc_route_annotations {
+  OSRMC_ROUTE_ANNOTATIONS_NONE = 0,
+  OSRMC_ROUTE_ANNOTATIONS_DURATION = 1,
+  OSRMC_ROUTE_ANNOTATIONS_DISTANCE = 2,
+  OSRMC_ROUTE_ANNOTATIONS_SPEED = 4,
+  OSRMC_ROUTE_ANNOTATIONS_NODES = 8,
+  OSRMC_ROUTE_ANNOTATIONS_ALL = 15
+} osrmc_route_annotations_t;
+
 typedef struct osrmc_table_params* osrmc_table_params_t;
 typedef struct osrmc_table_annotations* osrmc_table_annotations_t;
 typedef struct osrmc_nearest_params* osrmc_nearest_params_t;
 typedef struct osrmc_match_params* osrmc_match_params_t;
+typedef struct osrmc_trip_params* osrmc_trip_params_t;
+
+typedef enum osrmc_trip_source { OSRMC_TRIP_SOURCE_ANY = 0, OSRMC_TRIP_SOURCE_FIRST = 1 } osrmc_trip_source_t;
+typedef enum osrmc_trip_destination {
+  OSRMC_TRIP_DESTINATION_ANY = 0,
+  OSRMC_TRIP_DESTINATION_LAST = 1
+} osrmc_trip_destination_t;
 
 /* Service-specific responses */
 
 typedef struct osrmc_route_response* osrmc_route_response_t;
 typedef struct osrmc_table_response* osrmc_table_response_t;
+typedef struct osrmc_nearest_response* osrmc_nearest_response_t;
+typedef struct osrmc_match_response* osrmc_match_response_t;
+typedef struct osrmc_trip_response* osrmc_trip_response_t;
+
+/* Service-specific persistent state */
+
+typedef struct osrmc_matrix* osrmc_matrix_t;
+typedef struct osrmc_matcher* osrmc_matcher_t;
+typedef struct osrmc_arena* osrmc_arena_t;
+
+/* Service-specific summaries, plain values filled in by batch functions */
+
+typedef struct osrmc_route_summary {
+  float distance;
+  float duration;
+} osrmc_route_summary_t;
 
 /* Service-specific callbacks */
 
 typedef void (*osrmc_waypoint_handler_t)(void* data, const char* name, float longitude, float latitude);
+typedef void (*osrmc_route_response_handler_t)(void* data, osrmc_route_response_t response, osrmc_error_t error);
+typedef void (*osrmc_table_response_handler_t)(void* data, osrmc_table_response_t response, osrmc_error_t error);
+typedef void (*osrmc_matched_segment_handler_t)(void* data, size_t from, size_t to, float duration, float distance,
+                                                const float* geometry, size_t num_coordinates);
+
+/* Asynchronous completions */
+
+typedef struct osrmc_completion_queue* osrmc_completion_queue_t;
+
+/* Scheduling */
+
+typedef enum osrmc_priority { OSRMC_PRIORITY_INTERACTIVE = 0, OSRMC_PRIORITY_BATCH = 1 } osrmc_priority_t;
 
 
 /* Error handling */
@@ -165,15 +313,164 @@ typedef void (*osrmc_waypoint_handler_t)(void* data, const char* name, float lon
 OSRMC_API const char* osrmc_error_code(osrmc_error_t error);
 OSRMC_API const char* osrmc_error_message(osrmc_error_t error);
 OSRMC_API void osrmc_error_destruct(osrmc_error_t error);
+OSRMC_API osrmc_status_t osrmc_error_status(osrmc_error_t error);
+
+/* Status of the last failure on the calling thread, OSRMC_STATUS_OK if there was none since the last clear.
+ * Like errno, successful calls leave it untouched. Codes and messages are static strings. */
+OSRMC_API osrmc_status_t osrmc_last_status(void);
+OSRMC_API void osrmc_clear_status(void);
+OSRMC_API const char* osrmc_status_code(osrmc_status_t status);
+OSRMC_API const char* osrmc_status_message(osrmc_status_t status);
 
 /* Config and osrmc */
 
 OSRMC_API osrmc_config_t osrmc_config_construct(const char* base_path, osrmc_error_t* error);
 OSRMC_API void osrmc_config_destruct(osrmc_config_t config);
 
+/* Engine tuning, see libosrm's EngineConfig. Limits of -1 mean unlimited.
+ * The algorithm has to match the one the dataset was prepared for: osrm-contract for CH, osrm-partition and
+ * osrm-customize for MLD. */
+OSRMC_API void osrmc_config_set_algorithm(osrmc_config_t config, osrmc_algorithm_t algorithm, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_locations_trip(osrmc_config_t config, int value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_locations_viaroute(osrmc_config_t config, int value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_locations_distance_table(osrmc_config_t config, int value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_locations_map_matching(osrmc_config_t config, int value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_radius_map_matching(osrmc_config_t config, double value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_results_nearest(osrmc_config_t config, int value, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_max_alternatives(osrmc_config_t config, int value, osrmc_error_t* error);
+
+/* Dataset loading
+ *
+ * Without mmap a config constructed from a base path reads the dataset into private memory, one copy per process.
+ * With mmap the dataset files are memory-mapped instead: start-up only maps the files and all processes on a machine
+ * share the same page-cache backed pages. Enabling mmap disables shared memory; shared memory requires datasets
+ * loaded by osrm-datastore, optionally selected by dataset name. */
+OSRMC_API void osrmc_config_set_use_mmap(osrmc_config_t config, bool enable, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_use_shared_memory(osrmc_config_t config, bool enable, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_dataset_name(osrmc_config_t config, const char* name, osrmc_error_t* error);
+
+/* Number of worker threads used by batch functions; 0 (the default) uses the number of cores */
+OSRMC_API void osrmc_config_set_num_threads(osrmc_config_t config, unsigned num_threads, osrmc_error_t* error);
+
+/* Maximum number of Route and Table responses each kept in the osrm handle's LRU cache; 0 (the default) disables it.
+ * Queries are keyed by their coordinates quantized to 1e-5 degrees plus all response-affecting settings. */
+OSRMC_API void osrmc_config_set_cache_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error);
+
+/* Maximum number of coordinate to hint mappings kept by the osrm handle; 0 (the default) disables it.
+ * Hints returned for a coordinate get attached to later queries with the exact same coordinate, skipping snapping.
+ * Only applies to coordinates without explicit hint, radius, bearing or approach, and queries without excludes. */
+OSRMC_API void osrmc_config_set_hint_cache_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error);
+
+/* Per-service counters and latency histograms kept by the osrm handle, see osrmc_stats_snapshot; off by default.
+ * When disabled queries pay for a few well-predicted branches on the disabled recorder, when enabled for two clock
+ * reads and a few relaxed atomic adds. */
+OSRMC_API void osrmc_config_set_stats(osrmc_config_t config, bool enable, osrmc_error_t* error);
+
+/* Coalesces identical concurrent Route and Table queries, keyed like the cache; off by default.
+ * The first query runs, duplicates arriving while it is in flight wait for it and get a copy of its response or error.
+ * Combine with the cache to also serve duplicates arriving after it finished. Duplicates arriving after a reload
+ * switched datasets never wait for a query running on the previous dataset. */
+OSRMC_API void osrmc_config_set_coalescing(osrmc_config_t config, bool enable, osrmc_error_t* error);
+
+/* Limits the number of concurrently running scheduled queries, see osrmc_route_scheduled; 0 (the default) disables
+ * scheduling. Only the scheduled functions count against it, all others call the engine directly. The queue capacity
+ * bounds how many scheduled queries may wait for a slot, 0 (the default) is unbounded; queries beyond it fail right
+ * away with OSRMC_STATUS_OVERLOADED. */
+OSRMC_API void osrmc_config_set_max_concurrency(osrmc_config_t config, unsigned max_concurrency, osrmc_error_t* error);
+OSRMC_API void osrmc_config_set_queue_capacity(osrmc_config_t config, size_t capacity, osrmc_error_t* error);
+
 OSRMC_API osrmc_osrm_t osrmc_osrm_construct(osrmc_config_t config, osrmc_error_t* error);
 OSRMC_API void osrmc_osrm_destruct(osrmc_osrm_t osrm);
 
+/* Drops all cached responses, e.g. after the dataset changed. Hits and misses accumulate over the handle's lifetime. */
+OSRMC_API void osrmc_osrm_cache_clear(osrmc_osrm_t osrm);
+OSRMC_API void osrmc_osrm_cache_stats(osrmc_osrm_t osrm, unsigned long long* hits, unsigned long long* misses);
+
+/* Queries which ran on the engine (leaders) and duplicates served from their in-flight result (followers) */
+OSRMC_API void osrmc_osrm_coalescing_stats(osrmc_osrm_t osrm, unsigned long long* leaders,
+                                           unsigned long long* followers);
+
+/* Loads the dataset described by config and atomically switches the osrm handle over to it.
+ * Queries keep being served from the current dataset while loading; queries already running finish on it and it is
+ * released once the last of them is done. Caches are cleared after the switch. Blocks the calling thread for the
+ * duration of the load, which gets reported in load_seconds if not NULL. On failure the current dataset stays active.
+ * Only the engine settings of config are used, worker and cache settings are kept. */
+OSRMC_API void osrmc_osrm_reload(osrmc_osrm_t osrm, osrmc_config_t config, double* load_seconds,
+                                 osrmc_error_t* error);
+
+/* Warms up a dataset by reading the <base>.osrm* files the engine maps into the page cache in parallel on the worker
+ * pool, the spatial index first, then the graph, the names and everything else. The R-tree leaves in .fileIndex are
+ * mmapped in every loading mode and always warmed; the other files only with mmap, as private and shared memory hold
+ * them resident already. Shared memory datasets need the base path in config to locate .fileIndex, without it
+ * nothing is warmed and warm-up fails with OSRMC_STATUS_INVALID_VALUE. Stops after byte_budget bytes or
+ * time_budget_ms milliseconds, 0 meaning unlimited, and reports the bytes actually read in warmed_bytes if not NULL.
+ * Hold traffic back until it returns to avoid slow first queries. */
+OSRMC_API void osrmc_osrm_warmup(osrmc_osrm_t osrm, size_t byte_budget, unsigned time_budget_ms, size_t* warmed_bytes,
+                                 osrmc_error_t* error);
+
+/* Profiles
+ *
+ * Serves several datasets, typically one per profile such as car, bike and foot, from one process. The profiles share
+ * one worker pool of num_threads workers (0 uses the number of cores) instead of one per osrm handle, so their batch
+ * functions together never oversubscribe the cores. Each profile is an ordinary osrm handle owned by the profiles:
+ * query it with all osrmc functions; destructing it is a no-op, it goes away with the profiles. Ids are assigned in
+ * the order profiles are added.
+ * The memory of a profile is the size of the dataset files its engine loads or maps, which is what the dataset takes
+ * up in private memory or, with mmap, in the page cache once fully touched. Datasets in shared memory are owned by
+ * osrm-datastore and reported as 0. */
+
+OSRMC_API osrmc_profiles_t osrmc_profiles_construct(unsigned num_threads, osrmc_error_t* error);
+OSRMC_API void osrmc_profiles_destruct(osrmc_profiles_t profiles);
+
+/* Loads the dataset described by config under a unique name and returns the profile id; the config's number of
+ * threads is ignored in favor of the shared pool. On failure returns osrmc_profiles_count. */
+OSRMC_API size_t osrmc_profiles_add(osrmc_profiles_t profiles, const char* name, osrmc_config_t config,
+                                    osrmc_error_t* error);
+OSRMC_API size_t osrmc_profiles_count(osrmc_profiles_t profiles);
+/* Returns osrmc_profiles_count if there is no profile with the given name */
+OSRMC_API size_t osrmc_profiles_find(osrmc_profiles_t profiles, const char* name, osrmc_error_t* error);
+OSRMC_API osrmc_osrm_t osrmc_profiles_osrm(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error);
+OSRMC_API const char* osrmc_profiles_name(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error);
+/* Size in bytes of the profile's dataset files, see above */
+OSRMC_API size_t osrmc_profiles_memory(osrmc_profiles_t profiles, size_t id, osrmc_error_t* error);
+
+/* Stats
+ *
+ * Every engine query counts as one call of its service, including queries issued by batch, tiled and streaming
+ * functions; cache hits and coalesced duplicates do not reach the engine and are reported by osrmc_osrm_cache_stats
+ * and osrmc_osrm_coalescing_stats instead. Failed calls are counted by their osrmc_status_t; codes libosrm does not
+ * document are counted as OSRMC_STATUS_UNKNOWN. Scheduled queries the scheduler turns away count as failed calls with
+ * OSRMC_STATUS_TIMEOUT or OSRMC_STATUS_OVERLOADED, without latency samples.
+ * Latencies are split into the engine query and the extraction of the response from libosrm's JSON and are reported
+ * in seconds at the given quantile (0.5 for the median), with a relative error of about 3%; NAN without samples.
+ * Time spent in your handlers, e.g. of osrmc_route_with or the streaming matcher, is not part of either.
+ *
+ * Snapshots copy the counters without blocking queries; counters accumulate until reset. */
+OSRMC_API osrmc_stats_t osrmc_stats_snapshot(osrmc_osrm_t osrm, osrmc_error_t* error);
+OSRMC_API void osrmc_stats_destruct(osrmc_stats_t stats);
+OSRMC_API void osrmc_osrm_stats_reset(osrmc_osrm_t osrm);
+OSRMC_API unsigned long long osrmc_stats_calls(osrmc_stats_t stats, osrmc_service_t service);
+/* Failed calls with the given status, or all failed calls for OSRMC_STATUS_OK */
+OSRMC_API unsigned long long osrmc_stats_errors(osrmc_stats_t stats, osrmc_service_t service, osrmc_status_t status);
+OSRMC_API double osrmc_stats_engine_seconds(osrmc_stats_t stats, osrmc_service_t service, double quantile);
+OSRMC_API double osrmc_stats_extraction_seconds(osrmc_stats_t stats, osrmc_service_t service, double quantile);
+OSRMC_API double osrmc_stats_engine_total_seconds(osrmc_stats_t stats, osrmc_service_t service);
+OSRMC_API double osrmc_stats_extraction_total_seconds(osrmc_stats_t stats, osrmc_service_t service);
+
+/* Asynchronous completions */
+
+OSRMC_API osrmc_completion_queue_t osrmc_completion_queue_construct(osrmc_error_t* error);
+/* May be called while queued queries are still pending: the queue and its file descriptor are released once the last
+ * of them finished, and their responses and errors get destructed instead of delivered. */
+OSRMC_API void osrmc_completion_queue_destruct(osrmc_completion_queue_t queue);
+OSRMC_API int osrmc_completion_queue_fd(osrmc_completion_queue_t queue);
+
+/* Pops one completion if available, returning false otherwise. Never blocks.
+ * The response has to be cast to the service-specific response type the completion was submitted for.
+ * Exactly one of response and response_error is set; you take over ownership. */
+OSRMC_API bool osrmc_completion_queue_pop(osrmc_completion_queue_t queue, void** data, void** response,
+                                          osrmc_error_t* response_error);
+
 /* Generic parameters */
 
 OSRMC_API void osrmc_params_add_coordinate(osrmc_params_t params, float longitude, float latitude,
@@ -181,13 +478,37 @@ OSRMC_API void osrmc_params_add_coordinate(osrmc_params_t params, float longitud
 OSRMC_API void osrmc_params_add_coordinate_with(osrmc_params_t params, float longitude, float latitude, float radius,
                                                 int bearing, int range, osrmc_error_t* error);
 
+/* Attaches a hint as returned by the services' hint accessors to the coordinate at index; NULL removes it.
+ * Hints let the engine skip snapping the coordinate; they are ignored if they do not match the dataset. */
+OSRMC_API void osrmc_params_set_hint(osrmc_params_t params, size_t index, const char* hint, osrmc_error_t* error);
+
+/* Bulk variant appending n coordinates from struct-of-arrays in one go, reserving capacity once.
+ * radiuses may be NULL; bearings and ranges may be NULL but have to be passed together. */
+OSRMC_API void osrmc_params_add_coordinates(osrmc_params_t params, const float* longitudes, const float* latitudes,
+                                            size_t n, const float* radiuses, const int* bearings, const int* ranges,
+                                            osrmc_error_t* error);
+
 /* Route service */
 
 OSRMC_API osrmc_route_params_t osrmc_route_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_route_params_destruct(osrmc_route_params_t params);
+OSRMC_API void osrmc_route_params_reset(osrmc_route_params_t params);
+OSRMC_API osrmc_route_params_t osrmc_route_params_acquire(osrmc_error_t* error);
+OSRMC_API void osrmc_route_params_release(osrmc_route_params_t params);
 OSRMC_API void osrmc_route_params_add_steps(osrmc_route_params_t params, int on);
 OSRMC_API void osrmc_route_params_add_alternatives(osrmc_route_params_t params, int on);
 
+/* Route geometry, decoded into float coordinates by the library whichever encoding is used. Polyline6 is the cheapest
+ * to produce at full coordinate precision. Routes come with a simplified overview by default; disable the overview
+ * when you do not need the geometry to save the engine and the library the work. */
+OSRMC_API void osrmc_route_params_set_overview(osrmc_route_params_t params, osrmc_overview_t overview,
+                                               osrmc_error_t* error);
+OSRMC_API void osrmc_route_params_set_geometries(osrmc_route_params_t params, osrmc_geometries_t geometries,
+                                                 osrmc_error_t* error);
+/* Per-segment annotations to return, osrmc_route_annotations_t flags; none by default */
+OSRMC_API void osrmc_route_params_set_annotations(osrmc_route_params_t params, unsigned annotations,
+                                                  osrmc_error_t* error);
+
 OSRMC_API osrmc_route_response_t osrmc_route(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_error_t* error);
 OSRMC_API void osrmc_route_with(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_waypoint_handler_t handler,
                                 void* data, osrmc_error_t* error);
@@ -195,6 +516,40 @@ OSRMC_API void osrmc_route_response_destruct(osrmc_route_response_t response);
 OSRMC_API float osrmc_route_response_distance(osrmc_route_response_t response, osrmc_error_t* error);
 OSRMC_API float osrmc_route_response_duration(osrmc_route_response_t response, osrmc_error_t* error);
 
+/* Geometry and annotations per route, the first one being the best and the others alternatives.
+ * Views point into the response and stay valid until it is destructed. The geometry holds num_coordinates interleaved
+ * longitude, latitude pairs. Annotations hold one value per segment for all legs concatenated; nodes hold the OSM node
+ * ids per leg as libosrm reports them, that is one more than the leg's segments, concatenated. */
+OSRMC_API size_t osrmc_route_response_num_routes(osrmc_route_response_t response);
+OSRMC_API const float* osrmc_route_response_geometry(osrmc_route_response_t response, size_t route,
+                                                     size_t* num_coordinates, osrmc_error_t* error);
+OSRMC_API const float* osrmc_route_response_annotation_durations(osrmc_route_response_t response, size_t route,
+                                                                 size_t* length, osrmc_error_t* error);
+OSRMC_API const float* osrmc_route_response_annotation_distances(osrmc_route_response_t response, size_t route,
+                                                                 size_t* length, osrmc_error_t* error);
+OSRMC_API const float* osrmc_route_response_annotation_speeds(osrmc_route_response_t response, size_t route,
+                                                              size_t* length, osrmc_error_t* error);
+OSRMC_API const unsigned long long* osrmc_route_response_annotation_nodes(osrmc_route_response_t response,
+                                                                          size_t route, size_t* length,
+                                                                          osrmc_error_t* error);
+
+/* Per-waypoint hints; strings are owned by the response and valid until it gets destructed */
+OSRMC_API size_t osrmc_route_response_num_waypoints(osrmc_route_response_t response);
+OSRMC_API const char* osrmc_route_response_waypoint_hint(osrmc_route_response_t response, size_t index,
+                                                         osrmc_error_t* error);
+
+/* Runs n independent Route queries spread across the worker pool, blocking until all are done.
+ * Fills results[i] with the first route's summary and sets errors[i] to NULL on success.
+ * On failure results[i] is INFINITY and you take over ownership of errors[i]. Pass NULL for errors to skip allocating
+ * error objects; the calling thread's status then tells whether any query failed. */
+OSRMC_API void osrmc_route_batch(osrmc_osrm_t osrm, const osrmc_route_params_t* params, size_t n,
+                                 osrmc_route_summary_t* results, osrmc_error_t* errors);
+
+OSRMC_API void osrmc_route_async(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_route_response_handler_t handler,
+                                 void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_route_async_queued(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_completion_queue_t queue,
+                                        void* data, osrmc_error_t* error);
+
 /* Table service */
 
 OSRMC_API osrmc_table_annotations_t osrmc_table_annotations_construct(osrmc_error_t* error);
@@ -203,13 +558,42 @@ OSRMC_API void osrmc_table_annotations_enable_distance(osrmc_table_annotations_t
 
 OSRMC_API osrmc_table_params_t osrmc_table_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_destruct(osrmc_table_params_t params);
+OSRMC_API void osrmc_table_params_reset(osrmc_table_params_t params);
+OSRMC_API osrmc_table_params_t osrmc_table_params_acquire(osrmc_error_t* error);
+OSRMC_API void osrmc_table_params_release(osrmc_table_params_t params);
 OSRMC_API void osrmc_table_params_set_annotations(osrmc_table_params_t params, osrmc_table_annotations_t annotations, osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_add_source(osrmc_table_params_t params, size_t index, osrmc_error_t* error);
 OSRMC_API void osrmc_table_params_add_destination(osrmc_table_params_t params, size_t index, osrmc_error_t* error);
+OSRMC_API void osrmc_table_params_add_sources(osrmc_table_params_t params, const size_t* indices, size_t n,
+                                              osrmc_error_t* error);
+OSRMC_API void osrmc_table_params_add_destinations(osrmc_table_params_t params, const size_t* indices, size_t n,
+                                                   osrmc_error_t* error);
 
 OSRMC_API osrmc_table_response_t osrmc_table(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_error_t* error);
+
+/* Splits the sources x destinations table into tiles of at most tile_size sources and tile_size destinations,
+ * runs the tiles concurrently on the worker pool and stitches them into a single response.
+ * Lifts the engine's max locations limit for tables; a tile_size of 0 picks a default within that limit.
+ * If any tile fails the first error is reported and no response is returned. */
+OSRMC_API osrmc_table_response_t osrmc_table_tiled(osrmc_osrm_t osrm, osrmc_table_params_t params, size_t tile_size,
+                                                   osrmc_error_t* error);
 OSRMC_API void osrmc_table_response_destruct(osrmc_table_response_t response);
 
+OSRMC_API void osrmc_table_async(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_table_response_handler_t handler,
+                                 void* data, osrmc_error_t* error);
+OSRMC_API void osrmc_table_async_queued(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_completion_queue_t queue,
+                                        void* data, osrmc_error_t* error);
+
+/* Durations and distances for k unrelated origin-destination pairs, pair i going from source i to destination i.
+ * Pairs sharing an origin or destination are answered by small tables run concurrently on the worker pool, which is
+ * much cheaper than k Route queries or one k x k table. Pairs sharing nothing only go into the same table while it
+ * computes at most twice the cells asked for, otherwise they get small tables of their own. durations and distances
+ * are caller-owned arrays of k values, either may be NULL and only the requested ones are computed; unreachable pairs
+ * and pairs of failed tables are INFINITY, the first failure is reported. */
+OSRMC_API void osrmc_od_pairs(osrmc_osrm_t osrm, const float* source_longitudes, const float* source_latitudes,
+                              const float* destination_longitudes, const float* destination_latitudes, size_t k,
+                              float* durations, float* distances, osrmc_error_t* error);
+
 // INFINITY will be returned if there is no route between the from/to.
 // An error will also be returned with a code of 'NoRoute'.
 OSRMC_API float osrmc_table_response_duration(osrmc_table_response_t response, unsigned long from, unsigned long to,
@@ -217,18 +601,198 @@ OSRMC_API float osrmc_table_response_duration(osrmc_table_response_t response, u
 OSRMC_API float osrmc_table_response_distance(osrmc_table_response_t response, unsigned long from, unsigned long to,
                                               osrmc_error_t* error);
 
+/* Per-source and per-destination hints; strings are owned by the response and valid until it gets destructed */
+OSRMC_API const char* osrmc_table_response_source_hint(osrmc_table_response_t response, size_t index,
+                                                       osrmc_error_t* error);
+OSRMC_API const char* osrmc_table_response_destination_hint(osrmc_table_response_t response, size_t index,
+                                                            osrmc_error_t* error);
+
+/* Bulk export of the whole matrix into caller-owned buffers, in a single pass over the response.
+ * The matrix is written row-major: cell (from, to) lands at index from * num_destinations + to.
+ * size is the number of floats the buffer can hold and has to be at least num_sources * num_destinations.
+ * Unreachable cells are set to INFINITY; no per-cell NoRoute error is reported.
+ * If unreachable is not NULL it has to hold (size + 7) / 8 bytes and receives a bitmask with bit
+ * (index % 8) of byte (index / 8) set for every unreachable cell. */
+OSRMC_API size_t osrmc_table_response_num_sources(osrmc_table_response_t response, osrmc_error_t* error);
+OSRMC_API size_t osrmc_table_response_num_destinations(osrmc_table_response_t response, osrmc_error_t* error);
+OSRMC_API void osrmc_table_response_durations_copy(osrmc_table_response_t response, float* durations, size_t size,
+                                                   unsigned char* unreachable, osrmc_error_t* error);
+OSRMC_API void osrmc_table_response_distances_copy(osrmc_table_response_t response, float* distances, size_t size,
+                                                   unsigned char* unreachable, osrmc_error_t* error);
+
+/* Response arenas
+ *
+ * Pools of reusable Route and Table response structs for e.g. one request or one batch; reset releases all of them at
+ * once. Responses handed out by the _in variants belong to the arena: read them with the usual accessors, they are
+ * valid until the next reset. Destructing them is a no-op. Reset keeps their geometry, annotation, matrix and hint
+ * buffers around for reuse, so once an arena saw its typical load the library's side of a response no longer
+ * allocates. The engine's side does: libosrm still builds and frees its JSON result on the heap for every query, so
+ * the _in variants save allocations but do not make queries allocation-free. Not safe for concurrent use, use one
+ * arena per thread. */
+
+OSRMC_API osrmc_arena_t osrmc_arena_construct(osrmc_error_t* error);
+OSRMC_API void osrmc_arena_destruct(osrmc_arena_t arena);
+OSRMC_API void osrmc_arena_reset(osrmc_arena_t arena);
+
+OSRMC_API osrmc_route_response_t osrmc_route_in(osrmc_osrm_t osrm, osrmc_route_params_t params, osrmc_arena_t arena,
+                                                osrmc_error_t* error);
+OSRMC_API osrmc_table_response_t osrmc_table_in(osrmc_osrm_t osrm, osrmc_table_params_t params, osrmc_arena_t arena,
+                                                osrmc_error_t* error);
+
+/* Scheduled queries
+ *
+ * Same as osrmc_route and osrmc_table, but first wait for one of the osrm handle's max concurrency slots.
+ * Interactive queries are admitted before batch queries, and batch queries leave one slot to interactive ones: with a
+ * max concurrency of 1 there is none to leave and batch queries fail with OSRMC_STATUS_INVALID_VALUE.
+ * Admission control only governs these two functions. osrmc_route, osrmc_table and their async, batch, tiled, od-pair
+ * and matrix relatives bypass the slots, so the max concurrency only bounds engine load if all traffic is scheduled.
+ * A timeout_ms of 0 waits as long as it takes; otherwise queries still waiting at their deadline fail with
+ * OSRMC_STATUS_TIMEOUT without touching the engine. A running query is never interrupted.
+ * Without max concurrency configured these run right away. */
+
+OSRMC_API osrmc_route_response_t osrmc_route_scheduled(osrmc_osrm_t osrm, osrmc_route_params_t params,
+                                                       osrmc_priority_t priority, unsigned timeout_ms,
+                                                       osrmc_error_t* error);
+OSRMC_API osrmc_table_response_t osrmc_table_scheduled(osrmc_osrm_t osrm, osrmc_table_params_t params,
+                                                       osrmc_priority_t priority, unsigned timeout_ms,
+                                                       osrmc_error_t* error);
+
+/* Incremental Table matrix
+ *
+ * Owns a set of locations and keeps the full durations (and optionally distances) matrix between them up to date.
+ * Adding k locations to n only queries the k x (n + k) rows and the n x k columns; removing is a constant number of
+ * row and column moves: the last location takes over the removed location's index. Existing locations are passed to
+ * the engine with the hints they snapped to, so an add only snaps its k new locations; the n existing ones still cost
+ * a hint check each and their share of the request and response.
+ * The cell views are row-major with the returned stride, (from, to) is at from * stride + to, and stay valid until the
+ * next add or remove. Unreachable cells are INFINITY. Not safe for concurrent use. */
+
+OSRMC_API osrmc_matrix_t osrmc_matrix_construct(osrmc_osrm_t osrm, osrmc_table_annotations_t annotations,
+                                                osrmc_error_t* error);
+OSRMC_API void osrmc_matrix_destruct(osrmc_matrix_t matrix);
+OSRMC_API size_t osrmc_matrix_size(osrmc_matrix_t matrix);
+/* Returned by osrmc_matrix_add_locations on failure */
+#define OSRMC_MATRIX_INVALID_INDEX ((size_t)-1)
+
+/* Returns the index of the first added location; on failure OSRMC_MATRIX_INVALID_INDEX and the matrix is unchanged */
+OSRMC_API size_t osrmc_matrix_add_locations(osrmc_matrix_t matrix, const float* longitudes, const float* latitudes,
+                                            size_t n, osrmc_error_t* error);
+OSRMC_API void osrmc_matrix_remove_location(osrmc_matrix_t matrix, size_t index, osrmc_error_t* error);
+OSRMC_API const float* osrmc_matrix_durations(osrmc_matrix_t matrix, size_t* stride, osrmc_error_t* error);
+OSRMC_API const float* osrmc_matrix_distances(osrmc_matrix_t matrix, size_t* stride, osrmc_error_t* error);
+
 /* Nearest service */
 
 OSRMC_API osrmc_nearest_params_t osrmc_nearest_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_nearest_params_destruct(osrmc_nearest_params_t params);
+OSRMC_API void osrmc_nearest_params_reset(osrmc_nearest_params_t params);
+OSRMC_API osrmc_nearest_params_t osrmc_nearest_params_acquire(osrmc_error_t* error);
+OSRMC_API void osrmc_nearest_params_release(osrmc_nearest_params_t params);
 OSRMC_API void osrmc_nearest_set_number_of_results(osrmc_nearest_params_t params, unsigned n, osrmc_error_t* error);
 
+OSRMC_API osrmc_nearest_response_t osrmc_nearest(osrmc_osrm_t osrm, osrmc_nearest_params_t params,
+                                                 osrmc_error_t* error);
+OSRMC_API void osrmc_nearest_response_destruct(osrmc_nearest_response_t response);
+OSRMC_API size_t osrmc_nearest_response_count(osrmc_nearest_response_t response);
+OSRMC_API float osrmc_nearest_response_longitude(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error);
+OSRMC_API float osrmc_nearest_response_latitude(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error);
+OSRMC_API float osrmc_nearest_response_distance(osrmc_nearest_response_t response, size_t index, osrmc_error_t* error);
+/* The name is owned by the response and valid until it gets destructed */
+OSRMC_API const char* osrmc_nearest_response_name(osrmc_nearest_response_t response, size_t index,
+                                                  osrmc_error_t* error);
+
+OSRMC_API const char* osrmc_nearest_response_hint(osrmc_nearest_response_t response, size_t index,
+                                                  osrmc_error_t* error);
+
+/* Snaps n coordinates to their nearest road segment in parallel, writing into caller-owned arrays.
+ * Any of the output arrays may be NULL. Points which could not be snapped get NAN coordinates and INFINITY distance.
+ * hints receives one NUL-terminated OSRM hint per point at hints + i * hint_stride, or an empty string if it does not
+ * fit; pass the hints on to subsequent queries to skip snapping. Hints are only generated when hints is not NULL, and
+ * are never added to the osrm handle's hint cache.
+ * statuses receives OSRMC_STATUS_OK or the reason point i could not be snapped, e.g. OSRMC_STATUS_NO_SEGMENT.
+ * Points failing to snap do not make the call fail: error is only set if the batch itself could not be run, for
+ * example on allocation failure, in which case the outputs of the affected points are unspecified.
+ * Returns the number of snapped points. Each point still is one engine query: libosrm's Nearest snaps one coordinate
+ * at a time and returns a JSON result, of which only the requested fields are read. */
+OSRMC_API size_t osrmc_nearest_batch(osrmc_osrm_t osrm, const float* longitudes, const float* latitudes, size_t n,
+                                     float* snapped_longitudes, float* snapped_latitudes, float* distances,
+                                     char* hints, size_t hint_stride, osrmc_status_t* statuses, osrmc_error_t* error);
+
 /* Match service */
 
 OSRMC_API osrmc_match_params_t osrmc_match_params_construct(osrmc_error_t* error);
 OSRMC_API void osrmc_match_params_destruct(osrmc_match_params_t params);
+OSRMC_API void osrmc_match_params_reset(osrmc_match_params_t params);
+OSRMC_API osrmc_match_params_t osrmc_match_params_acquire(osrmc_error_t* error);
+OSRMC_API void osrmc_match_params_release(osrmc_match_params_t params);
 OSRMC_API void osrmc_match_params_add_timestamp(osrmc_match_params_t params, unsigned timestamp, osrmc_error_t* error);
 
+OSRMC_API osrmc_match_response_t osrmc_match(osrmc_osrm_t osrm, osrmc_match_params_t params, osrmc_error_t* error);
+OSRMC_API void osrmc_match_response_destruct(osrmc_match_response_t response);
+OSRMC_API size_t osrmc_match_response_num_matchings(osrmc_match_response_t response);
+OSRMC_API float osrmc_match_response_distance(osrmc_match_response_t response, size_t matching, osrmc_error_t* error);
+OSRMC_API float osrmc_match_response_duration(osrmc_match_response_t response, size_t matching, osrmc_error_t* error);
+OSRMC_API float osrmc_match_response_confidence(osrmc_match_response_t response, size_t matching,
+                                                osrmc_error_t* error);
+/* One tracepoint per input coordinate; returns false and NAN coordinates if it was not matched */
+OSRMC_API size_t osrmc_match_response_num_tracepoints(osrmc_match_response_t response);
+OSRMC_API bool osrmc_match_response_tracepoint(osrmc_match_response_t response, size_t index, float* longitude,
+                                               float* latitude, osrmc_error_t* error);
+
+/* Streaming matcher for live traces
+ *
+ * Accepts fixes one at a time and matches a sliding window of at most window fixes. Fixes are numbered from 0 in the
+ * order they are pushed, over the matcher's lifetime.
+ * Whenever the window is full, all but the newest context fixes are finalized: the handler receives, in order, the
+ * matched segments ending in them. A segment goes from one matched fix to the next matched fix of the same matching,
+ * with its duration, distance and, if geometry is enabled, its num_coordinates interleaved longitude, latitude pairs;
+ * the geometry is only valid during the call. Fixes without a segment ending in them were not matched or start a new
+ * matching. The newest context fixes stay in the window as lookahead, and the newest context finalized fixes stay as
+ * history, so segments leaving them are matched with the earlier context. The window has to hold more than twice the
+ * context. Flushing finalizes all buffered fixes and drops the history, e.g. at the end of a trip. The handler runs
+ * on the pushing thread. Per-fix cost is constant: window / (window - 2 * context) matches of window fixes each;
+ * geometry additionally has the engine compute the legs' steps. */
+
+OSRMC_API osrmc_matcher_t osrmc_matcher_construct(osrmc_osrm_t osrm, size_t window, size_t context, bool geometry,
+                                                  osrmc_matched_segment_handler_t handler, void* data,
+                                                  osrmc_error_t* error);
+OSRMC_API void osrmc_matcher_destruct(osrmc_matcher_t matcher);
+OSRMC_API void osrmc_matcher_push(osrmc_matcher_t matcher, float longitude, float latitude, unsigned timestamp,
+                                  osrmc_error_t* error);
+OSRMC_API void osrmc_matcher_flush(osrmc_matcher_t matcher, osrmc_error_t* error);
+
+/* Trip service
+ *
+ * Solves the traveling salesman problem over the coordinates inside the engine, no matrix leaves the library.
+ * Round trips return to their start; without round trip the source has to be the first and the destination the last
+ * coordinate. Disconnected coordinates end up in separate trips. Trip parameters are route parameters as well: cast
+ * them to osrmc_route_params_t for the route settings, e.g. to disable the overview geometry you do not need here. */
+
+OSRMC_API osrmc_trip_params_t osrmc_trip_params_construct(osrmc_error_t* error);
+OSRMC_API void osrmc_trip_params_destruct(osrmc_trip_params_t params);
+OSRMC_API void osrmc_trip_params_reset(osrmc_trip_params_t params);
+OSRMC_API osrmc_trip_params_t osrmc_trip_params_acquire(osrmc_error_t* error);
+OSRMC_API void osrmc_trip_params_release(osrmc_trip_params_t params);
+OSRMC_API void osrmc_trip_params_set_roundtrip(osrmc_trip_params_t params, bool on, osrmc_error_t* error);
+OSRMC_API void osrmc_trip_params_set_source(osrmc_trip_params_t params, osrmc_trip_source_t source,
+                                            osrmc_error_t* error);
+OSRMC_API void osrmc_trip_params_set_destination(osrmc_trip_params_t params, osrmc_trip_destination_t destination,
+                                                 osrmc_error_t* error);
+
+OSRMC_API osrmc_trip_response_t osrmc_trip(osrmc_osrm_t osrm, osrmc_trip_params_t params, osrmc_error_t* error);
+OSRMC_API void osrmc_trip_response_destruct(osrmc_trip_response_t response);
+OSRMC_API size_t osrmc_trip_response_num_trips(osrmc_trip_response_t response);
+OSRMC_API float osrmc_trip_response_distance(osrmc_trip_response_t response, size_t trip, osrmc_error_t* error);
+OSRMC_API float osrmc_trip_response_duration(osrmc_trip_response_t response, size_t trip, osrmc_error_t* error);
+/* Views into the response, valid until it is destructed. The order holds the trip's input coordinate indices in
+ * visiting order; legs go from each visited coordinate to the next, for round trips back to the first one. */
+OSRMC_API const size_t* osrmc_trip_response_order(osrmc_trip_response_t response, size_t trip, size_t* length,
+                                                  osrmc_error_t* error);
+OSRMC_API const float* osrmc_trip_response_leg_durations(osrmc_trip_response_t response, size_t trip,
+                                                         size_t* length, osrmc_error_t* error);
+OSRMC_API const float* osrmc_trip_response_leg_distances(osrmc_trip_response_t response, size_t trip,
+                                                         size_t* length, osrmc_error_t* error);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../osrmc.h"
+
+
+/* Functional tests for the osrmc extensions with concurrent or incremental state.
+ *
+ * Runs against two datasets built from the synthetic grid written by gen_grid.py: base.osrm from the grid given on
+ * the command line and reload.osrm from the same grid with twice the spacing, so routes between the same coordinates
+ * differ between the two. Checks the incremental matrix against full tables, the scheduler's priority classes and
+ * deadlines, the result cache across a reload and the trip visiting order. See `make test` for the setup.
+ */
+
+
+struct test_grid {
+  unsigned rows;
+  unsigned cols;
+  double spacing;
+  double longitude;
+  double latitude;
+};
+
+struct test_options {
+  const char* base_path;
+  const char* reload_path;
+  osrmc_algorithm_t algorithm;
+  struct test_grid grid;
+};
+
+static unsigned test_failures;
+
+static void test_check(int ok, const char* what, const char* file, int line) {
+  if (ok)
+    return;
+
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  ++test_failures;
+}
+
+#define TEST_CHECK(condition) test_check((condition) != 0, #condition, __FILE__, __LINE__)
+
+/* Reports and frees error, returns whether there was one */
+static int test_error(const char* what, osrmc_error_t error) {
+  if (!error)
+    return 0;
+
+  fprintf(stderr, "%s: %s: %s\n", what, osrmc_error_code(error), osrmc_error_message(error));
+  osrmc_error_destruct(error);
+  ++test_failures;
+  return 1;
+}
+
+/* Location of the grid's street crossing at row, col */
+static void test_node(const struct test_grid* grid, unsigned row, unsigned col, float* longitude, float* latitude) {
+  *longitude = (float)(grid->longitude + col * grid->spacing);
+  *latitude = (float)(grid->latitude + row * grid->spacing);
+}
+
+static int test_same(float lhs, float rhs) {
+  if (isinf(lhs) || isinf(rhs))
+    return isinf(lhs) && isinf(rhs);
+
+  return fabsf(lhs - rhs) <= 0.1f;
+}
+
+static osrmc_osrm_t test_construct(const struct test_options* options, const char* base_path, size_t cache_capacity,
+                                   unsigned max_concurrency) {
+  osrmc_error_t error = NULL;
+  osrmc_config_t config;
+  osrmc_osrm_t osrm = NULL;
+
+  config = osrmc_config_construct(base_path, &error);
+  if (test_error("config", error))
+    return NULL;
+
+  osrmc_config_set_algorithm(config, options->algorithm, &error);
+  osrmc_config_set_cache_capacity(config, cache_capacity, &error);
+  osrmc_config_set_max_concurrency(config, max_concurrency, &error);
+
+  if (!test_error("config", error)) {
+    osrm = osrmc_osrm_construct(config, &error);
+    test_error("osrm", error);
+  }
+
+  osrmc_config_destruct(config);
+  return osrm;
+}
+
+
+/* Incremental matrix: adds and a swap-remove have to end up with the cells of one full table */
+
+static void test_matrix(const struct test_options* options) {
+  const struct test_grid* grid = &options->grid;
+
+  osrmc_error_t error = NULL;
+  osrmc_osrm_t osrm;
+  osrmc_matrix_t matrix;
+  osrmc_table_params_t params;
+  osrmc_table_response_t response = NULL;
+  float longitudes[8], latitudes[8];
+  float expected[7 * 7];
+  const float* durations;
+  size_t first, stride = 0, from, to, i;
+
+  /* The last location takes over the removed location's index */
+  static const size_t order[7] = {0, 1, 7, 3, 4, 5, 6};
+
+  osrm = test_construct(options, options->base_path, 0, 0);
+  if (!osrm)
+    return;
+
+  for (i = 0; i < 8; ++i)
+    test_node(grid, (unsigned)(i * 3 % grid->rows), (unsigned)(i * 5 % grid->cols), &longitudes[i], &latitudes[i]);
+
+  matrix = osrmc_matrix_construct(osrm, NULL, &error);
+  if (test_error("matrix", error))
+    goto osrm_cleanup;
+
+  first = osrmc_matrix_add_locations(matrix, longitudes, latitudes, 5, &error);
+  TEST_CHECK(first == 0);
+
+  first = osrmc_matrix_add_locations(matrix, longitudes + 5, latitudes + 5, 3, &error);
+  TEST_CHECK(first == 5);
+
+  osrmc_matrix_remove_location(matrix, 2, &error);
+  if (test_error("matrix update", error))
+    goto matrix_cleanup;
+
+  TEST_CHECK(osrmc_matrix_size(matrix) == 7);
+
+  params = osrmc_table_params_construct(&error);
+  if (test_error("table params", error))
+    goto matrix_cleanup;
+
+  for (i = 0; i < 7 && !error; ++i)
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[order[i]], latitudes[order[i]], &error);
+
+  if (!error)
+    response = osrmc_table(osrm, params, &error);
+
+  if (!error) {
+    osrmc_table_response_durations_copy(response, expected, 7 * 7, NULL, &error);
+    osrmc_table_response_destruct(response);
+  }
+
+  if (!test_error("table", error)) {
+    durations = osrmc_matrix_durations(matrix, &stride, &error);
+
+    if (!test_error("matrix durations", error)) {
+      TEST_CHECK(stride >= 7);
+
+      for (from = 0; from < 7; ++from)
+        for (to = 0; to < 7; ++to)
+          TEST_CHECK(test_same(durations[from * stride + to], expected[from * 7 + to]));
+    }
+  }
+
+  osrmc_table_params_destruct(params);
+matrix_cleanup:
+  osrmc_matrix_destruct(matrix);
+osrm_cleanup:
+  osrmc_osrm_destruct(osrm);
+}
+
+
+/* Scheduler: batch tables contend for their single slot and time out, the interactive routes never wait for them */
+
+struct test_scheduled {
+  pthread_t thread;
+  osrmc_osrm_t osrm;
+  const struct test_options* options;
+  osrmc_priority_t priority;
+  unsigned timeout_ms;
+  unsigned iterations;
+  unsigned ok;
+  unsigned timeouts;
+  unsigned failures;
+};
+
+static void* test_scheduled_run(void* data) {
+  struct test_scheduled* scheduled = data;
+  const struct test_grid* grid = &scheduled->options->grid;
+
+  osrmc_error_t error = NULL;
+  osrmc_route_params_t route_params;
+  osrmc_table_params_t table_params;
+  float longitude, latitude;
+  unsigned i, row, col;
+  int ok;
+
+  route_params = osrmc_route_params_construct(&error);
+  table_params = osrmc_table_params_construct(&error);
+
+  if (test_error("scheduled params", error))
+    goto cleanup;
+
+  test_node(grid, 0, 0, &longitude, &latitude);
+  osrmc_params_add_coordinate((osrmc_params_t)route_params, longitude, latitude, &error);
+  test_node(grid, grid->rows - 1, grid->cols - 1, &longitude, &latitude);
+  osrmc_params_add_coordinate((osrmc_params_t)route_params, longitude, latitude, &error);
+
+  /* All crossings to all crossings: long enough for the batch slot to stay busy past the waiting queries' deadline */
+  for (row = 0; row < grid->rows; ++row) {
+    for (col = 0; col < grid->cols; ++col) {
+      test_node(grid, row, col, &longitude, &latitude);
+      osrmc_params_add_coordinate((osrmc_params_t)table_params, longitude, latitude, &error);
+    }
+  }
+
+  if (test_error("scheduled params", error))
+    goto cleanup;
+
+  for (i = 0; i < scheduled->iterations; ++i) {
+    /* Failures only set the thread's status */
+    osrmc_clear_status();
+
+    if (scheduled->priority == OSRMC_PRIORITY_BATCH) {
+      osrmc_table_response_t response =
+          osrmc_table_scheduled(scheduled->osrm, table_params, scheduled->priority, scheduled->timeout_ms, NULL);
+      ok = response != NULL;
+      osrmc_table_response_destruct(response);
+    } else {
+      osrmc_route_response_t response =
+          osrmc_route_scheduled(scheduled->osrm, route_params, scheduled->priority, scheduled->timeout_ms, NULL);
+      ok = response != NULL;
+      osrmc_route_response_destruct(response);
+    }
+
+    if (ok)
+      ++scheduled->ok;
+    else if (osrmc_last_status() == OSRMC_STATUS_TIMEOUT)
+      ++scheduled->timeouts;
+    else
+      ++scheduled->failures;
+  }
+
+cleanup:
+  osrmc_route_params_destruct(route_params);
+  osrmc_table_params_destruct(table_params);
+  return NULL;
+}
+
+static void test_scheduler(const struct test_options* options) {
+  struct test_scheduled single, batch[4], interactive;
+  osrmc_osrm_t osrm;
+  unsigned i;
+
+  /* A single slot leaves none for batch queries to leave to interactive ones */
+  osrm = test_construct(options, options->base_path, 0, 1);
+  if (!osrm)
+    return;
+
+  memset(&single, 0, sizeof(single));
+  single.osrm = osrm;
+  single.options = options;
+  single.priority = OSRMC_PRIORITY_BATCH;
+  single.iterations = 1;
+  test_scheduled_run(&single);
+
+  TEST_CHECK(single.ok == 0 && single.failures == 1);
+  TEST_CHECK(osrmc_last_status() == OSRMC_STATUS_INVALID_VALUE);
+
+  osrmc_osrm_destruct(osrm);
+
+  /* Two slots: batch queries take at most one of them */
+  osrm = test_construct(options, options->base_path, 0, 2);
+  if (!osrm)
+    return;
+
+  for (i = 0; i < 4; ++i) {
+    memset(&batch[i], 0, sizeof(batch[i]));
+    batch[i].osrm = osrm;
+    batch[i].options = options;
+    batch[i].priority = OSRMC_PRIORITY_BATCH;
+    batch[i].timeout_ms = 1;
+    batch[i].iterations = 10;
+  }
+
+  memset(&interactive, 0, sizeof(interactive));
+  interactive.osrm = osrm;
+  interactive.options = options;
+  interactive.priority = OSRMC_PRIORITY_INTERACTIVE;
+  interactive.timeout_ms = 1000;
+  interactive.iterations = 50;
+
+  for (i = 0; i < 4; ++i)
+    pthread_create(&batch[i].thread, NULL, test_scheduled_run, &batch[i]);
+
+  pthread_create(&interactive.thread, NULL, test_scheduled_run, &interactive);
+
+  for (i = 0; i < 4; ++i)
+    pthread_join(batch[i].thread, NULL);
+
+  pthread_join(interactive.thread, NULL);
+
+  {
+    unsigned batch_ok = 0, batch_timeouts = 0, batch_failures = 0;
+
+    for (i = 0; i < 4; ++i) {
+      batch_ok += batch[i].ok;
+      batch_timeouts += batch[i].timeouts;
+      batch_failures += batch[i].failures;
+    }
+
+    TEST_CHECK(batch_ok > 0);
+    TEST_CHECK(batch_timeouts > 0);
+    TEST_CHECK(batch_failures == 0);
+  }
+
+  TEST_CHECK(interactive.ok == interactive.iterations);
+
+  osrmc_osrm_destruct(osrm);
+}
+
+
+/* Reload: cached results of the previous dataset must not be served afterwards */
+
+static float test_route_distance(osrmc_osrm_t osrm, const float* longitudes, const float* latitudes) {
+  osrmc_error_t error = NULL;
+  osrmc_route_params_t params;
+  osrmc_route_response_t response;
+  float distance = NAN;
+
+  params = osrmc_route_params_construct(&error);
+  osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[0], latitudes[0], &error);
+  osrmc_params_add_coordinate((osrmc_params_t)params, longitudes[1], latitudes[1], &error);
+
+  if (!error) {
+    response = osrmc_route(osrm, params, &error);
+
+    if (!error) {
+      distance = osrmc_route_response_distance(response, &error);
+      osrmc_route_response_destruct(response);
+    }
+  }
+
+  test_error("route", error);
+  osrmc_route_params_destruct(params);
+  return distance;
+}
+
+static void test_reload(const struct test_options* options) {
+  osrmc_error_t error = NULL;
+  osrmc_config_t config;
+  osrmc_osrm_t osrm, reloaded;
+  float longitudes[2], latitudes[2];
+  float before, cached, expected, after;
+  unsigned long long hits, misses;
+
+  /* A crossing on the base grid is mid-block on the reload grid, so the route differs */
+  test_node(&options->grid, 0, 0, &longitudes[0], &latitudes[0]);
+  test_node(&options->grid, 1, 1, &longitudes[1], &latitudes[1]);
+
+  osrm = test_construct(options, options->base_path, 16, 0);
+  reloaded = test_construct(options, options->reload_path, 0, 0);
+
+  if (!osrm || !reloaded)
+    goto cleanup;
+
+  before = test_route_distance(osrm, longitudes, latitudes);
+  cached = test_route_distance(osrm, longitudes, latitudes);
+  expected = test_route_distance(reloaded, longitudes, latitudes);
+
+  osrmc_osrm_cache_stats(osrm, &hits, &misses);
+  TEST_CHECK(hits == 1 && misses == 1);
+  TEST_CHECK(test_same(before, cached));
+  TEST_CHECK(!test_same(before, expected));
+
+  config = osrmc_config_construct(options->reload_path, &error);
+  osrmc_config_set_algorithm(config, options->algorithm, &error);
+
+  if (!error)
+    osrmc_osrm_reload(osrm, config, NULL, &error);
+
+  osrmc_config_destruct(config);
+
+  if (test_error("reload", error))
+    goto cleanup;
+
+  after = test_route_distance(osrm, longitudes, latitudes);
+  TEST_CHECK(test_same(after, expected));
+
+cleanup:
+  osrmc_osrm_destruct(osrm);
+  osrmc_osrm_destruct(reloaded);
+}
+
+
+/* Trip: the order lists input indices in visiting order, not each input's position in the trip */
+
+static void test_trip(const struct test_options* options) {
+  osrmc_error_t error = NULL;
+  osrmc_osrm_t osrm;
+  osrmc_trip_params_t params;
+  osrmc_trip_response_t response;
+  const size_t* order;
+  size_t length = 0, i;
+  float longitude, latitude;
+
+  /* Crossings along the first street, given out of order: visiting them left to right is the only optimal trip */
+  static const unsigned cols[5] = {0, 3, 1, 2, 4};
+  static const size_t expected[5] = {0, 2, 3, 1, 4};
+
+  osrm = test_construct(options, options->base_path, 0, 0);
+  if (!osrm)
+    return;
+
+  params = osrmc_trip_params_construct(&error);
+  osrmc_trip_params_set_roundtrip(params, false, &error);
+  osrmc_trip_params_set_source(params, OSRMC_TRIP_SOURCE_FIRST, &error);
+  osrmc_trip_params_set_destination(params, OSRMC_TRIP_DESTINATION_LAST, &error);
+
+  for (i = 0; i < 5; ++i) {
+    test_node(&options->grid, 0, cols[i], &longitude, &latitude);
+    osrmc_params_add_coordinate((osrmc_params_t)params, longitude, latitude, &error);
+  }
+
+  if (!test_error("trip params", error)) {
+    response = osrmc_trip(osrm, params, &error);
+
+    if (!test_error("trip", error)) {
+      TEST_CHECK(osrmc_trip_response_num_trips(response) == 1);
+
+      order = osrmc_trip_response_order(response, 0, &length, &error);
+
+      if (!test_error("trip order", error)) {
+        TEST_CHECK(length == 5);
+
+        for (i = 0; i < length && i < 5; ++i)
+          TEST_CHECK(order[i] == expected[i]);
+      }
+
+      osrmc_trip_response_destruct(response);
+    }
+  }
+
+  osrmc_trip_params_destruct(params);
+  osrmc_osrm_destruct(osrm);
+}
+
+
+/* Command line */
+
+static void test_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] base.osrm reload.osrm\n"
+          "  -a ch|mld           routing algorithm the datasets were prepared for (default ch)\n"
+          "  -g rows,cols,spacing,longitude,latitude\n"
+          "                      grid base.osrm was generated from (default 20,20,0.001,13.38,52.51)\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  struct test_options options = {NULL, NULL, OSRMC_ALGORITHM_CH, {20, 20, 0.001, 13.38, 52.51}};
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:g:h")) != -1) {
+    switch (opt) {
+    case 'a':
+      if (strcmp(optarg, "ch") == 0)
+        options.algorithm = OSRMC_ALGORITHM_CH;
+      else if (strcmp(optarg, "mld") == 0)
+        options.algorithm = OSRMC_ALGORITHM_MLD;
+      else {
+        fprintf(stderr, "Invalid algorithm: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'g':
+      if (sscanf(optarg, "%u,%u,%lf,%lf,%lf", &options.grid.rows, &options.grid.cols, &options.grid.spacing,
+                 &options.grid.longitude, &options.grid.latitude) != 5 ||
+          options.grid.rows < 5 || options.grid.cols < 5 || options.grid.spacing <= 0) {
+        fprintf(stderr, "Invalid grid, needs at least 5 rows and columns: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      test_usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 2 != argc) {
+    test_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  options.base_path = argv[optind];
+  options.reload_path = argv[optind + 1];
+
+  test_matrix(&options);
+  test_scheduler(&options);
+  test_reload(&options);
+  test_trip(&options);
+
+  if (test_failures > 0) {
+    fprintf(stderr, "%u checks failed\n", test_failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}